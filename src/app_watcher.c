@@ -0,0 +1,242 @@
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "app_watcher.h"
+#include "log.h"
+#include "string_vec.h"
+#include "xmalloc.h"
+
+/*
+ * Watch the application dirs for changes, so a long-running tofi can refresh
+ * its list of apps without anyone having to restart it.
+ *
+ * Installing a package tends to touch lots of files in quick succession, so
+ * rather than refreshing on every event, we collect the dirs that changed and
+ * only report them once things have been quiet for a little while.
+ *
+ * Application dirs that don't exist yet are common (e.g.
+ * ~/.local/share/applications on a fresh system), so for those we watch the
+ * parent instead, and treat the dir being created as a change.
+ */
+
+#define SETTLE_TIME_MS 150
+
+static const uint32_t dir_mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM
+	| IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF
+	| IN_MOVE_SELF | IN_ONLYDIR;
+static const uint32_t parent_mask = IN_CREATE | IN_MOVED_TO | IN_ONLYDIR;
+
+bool app_watcher_init(struct app_watcher *watcher)
+{
+	*watcher = (struct app_watcher) {
+		.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC),
+		.changed = string_vec_create()
+	};
+	if (watcher->fd == -1) {
+		log_error("Failed to initialise inotify: %s.\n", strerror(errno));
+		string_vec_destroy(&watcher->changed);
+		return false;
+	}
+	return true;
+}
+
+static void free_watches(struct app_watch *watches, size_t num_watches)
+{
+	for (size_t i = 0; i < num_watches; i++) {
+		free(watches[i].path);
+	}
+	free(watches);
+}
+
+void app_watcher_destroy(struct app_watcher *watcher)
+{
+	free_watches(watcher->watches, watcher->num_watches);
+	string_vec_destroy(&watcher->changed);
+	close(watcher->fd);
+}
+
+static bool has_watch(const struct app_watch *watches, size_t num_watches, int wd)
+{
+	for (size_t i = 0; i < num_watches; i++) {
+		if (watches[i].wd == wd) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void add_watch(struct app_watcher *watcher, const char *path)
+{
+	bool missing = false;
+	int wd = inotify_add_watch(watcher->fd, path, dir_mask);
+	if (wd == -1 && errno == ENOENT) {
+		/* Missing siblings share their parent's watch, so add to it. */
+		char *copy = xstrdup(path);
+		wd = inotify_add_watch(watcher->fd, dirname(copy), parent_mask | IN_MASK_ADD);
+		free(copy);
+		missing = true;
+	}
+	if (wd == -1) {
+		log_debug("Not watching %s: %s.\n", path, strerror(errno));
+		return;
+	}
+	watcher->watches = xrealloc(
+			watcher->watches,
+			(watcher->num_watches + 1) * sizeof(*watcher->watches));
+	watcher->watches[watcher->num_watches] = (struct app_watch) {
+		.wd = wd,
+		.path = xstrdup(path),
+		.missing = missing
+	};
+	watcher->num_watches++;
+}
+
+/*
+ * Watch dirs instead of whatever we were watching before. This should be
+ * called after each refresh, as the dirs to watch may have changed.
+ *
+ * Watching a dir that's already watched just gives back the same watch, so
+ * only those that are no longer wanted are removed, and we never miss events
+ * for the dirs in both lists.
+ */
+void app_watcher_watch(struct app_watcher *watcher, const struct string_vec *dirs)
+{
+	struct app_watch *old = watcher->watches;
+	size_t num_old = watcher->num_watches;
+	watcher->watches = NULL;
+	watcher->num_watches = 0;
+	for (size_t i = 0; i < dirs->count; i++) {
+		add_watch(watcher, dirs->buf[i].string);
+	}
+	for (size_t i = 0; i < num_old; i++) {
+		int wd = old[i].wd;
+		if (!has_watch(watcher->watches, watcher->num_watches, wd)
+				&& !has_watch(old, i, wd)) {
+			inotify_rm_watch(watcher->fd, wd);
+		}
+	}
+	free_watches(old, num_old);
+	log_debug("Watching %zu application dirs.\n", watcher->num_watches);
+}
+
+static void note_change(struct app_watcher *watcher, const char *path)
+{
+	for (size_t i = 0; i < watcher->changed.count; i++) {
+		if (!strcmp(watcher->changed.buf[i].string, path)) {
+			return;
+		}
+	}
+	string_vec_add(&watcher->changed, path);
+}
+
+static bool basename_matches(const char *path, const char *name)
+{
+	size_t len = strlen(path);
+	while (len > 1 && path[len - 1] == '/') {
+		len--;
+	}
+	const char *base = path + len;
+	while (base > path && base[-1] != '/') {
+		base--;
+	}
+	size_t base_len = path + len - base;
+	return strlen(name) == base_len && strncmp(base, name, base_len) == 0;
+}
+
+static void handle_event(struct app_watcher *watcher, const struct inotify_event *event)
+{
+	if (event->mask & IN_IGNORED) {
+		/* A watch has gone, whether we removed it or its dir did. */
+		return;
+	}
+	/* Several entries may share a watch descriptor, e.g. missing siblings. */
+	for (size_t i = 0; i < watcher->num_watches; i++) {
+		struct app_watch *watch = &watcher->watches[i];
+		if (watch->wd != event->wd) {
+			continue;
+		}
+		if (watch->missing) {
+			if (event->len == 0 || !basename_matches(watch->path, event->name)) {
+				continue;
+			}
+		}
+		note_change(watcher, watch->path);
+		watcher->pending = true;
+	}
+	if (event->mask & IN_Q_OVERFLOW) {
+		/* We've lost track, so just check everything. */
+		for (size_t i = 0; i < watcher->num_watches; i++) {
+			note_change(watcher, watcher->watches[i].path);
+		}
+		watcher->pending = true;
+	}
+}
+
+/* Read any pending events, and push back the deadline if there were some. */
+void app_watcher_read(struct app_watcher *watcher)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool any = false;
+	while (true) {
+		ssize_t len = read(watcher->fd, buf, sizeof(buf));
+		if (len == -1 && errno == EINTR) {
+			continue;
+		}
+		if (len <= 0) {
+			break;
+		}
+		for (char *ptr = buf; ptr < buf + len; ) {
+			const struct inotify_event *event = (const struct inotify_event *)ptr;
+			handle_event(watcher, event);
+			ptr += sizeof(*event) + event->len;
+		}
+		any = true;
+	}
+	if (any && watcher->pending) {
+		clock_gettime(CLOCK_MONOTONIC, &watcher->deadline);
+		watcher->deadline.tv_nsec += SETTLE_TIME_MS * 1000000L;
+		if (watcher->deadline.tv_nsec >= 1000000000L) {
+			watcher->deadline.tv_sec++;
+			watcher->deadline.tv_nsec -= 1000000000L;
+		}
+	}
+}
+
+/*
+ * The poll() timeout until changes should be acted on, or -1 if there aren't
+ * any.
+ */
+int app_watcher_timeout(const struct app_watcher *watcher)
+{
+	if (!watcher->pending) {
+		return -1;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t ms = (watcher->deadline.tv_sec - now.tv_sec) * 1000
+		+ (watcher->deadline.tv_nsec - now.tv_nsec) / 1000000;
+	if (ms < 0) {
+		return 0;
+	}
+	return ms + 1;
+}
+
+/* Whether things have settled down, and the apps should be refreshed. */
+bool app_watcher_ready(const struct app_watcher *watcher)
+{
+	return watcher->pending && app_watcher_timeout(watcher) == 0;
+}
+
+void app_watcher_clear(struct app_watcher *watcher)
+{
+	string_vec_destroy(&watcher->changed);
+	watcher->changed = string_vec_create();
+	watcher->pending = false;
+}
@@ -0,0 +1,35 @@
+#ifndef APP_WATCHER_H
+#define APP_WATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "string_vec.h"
+
+struct app_watch {
+	int wd;
+	/* The dir we care about, which is the watched dir's child if missing. */
+	char *path;
+	bool missing;
+};
+
+struct app_watcher {
+	int fd;
+	struct app_watch *watches;
+	size_t num_watches;
+
+	/* Dirs something has happened in since the last refresh. */
+	struct string_vec changed;
+	bool pending;
+	struct timespec deadline;
+};
+
+bool app_watcher_init(struct app_watcher *watcher);
+void app_watcher_destroy(struct app_watcher *watcher);
+void app_watcher_watch(struct app_watcher *watcher, const struct string_vec *dirs);
+void app_watcher_read(struct app_watcher *watcher);
+int app_watcher_timeout(const struct app_watcher *watcher);
+bool app_watcher_ready(const struct app_watcher *watcher);
+void app_watcher_clear(struct app_watcher *watcher);
+
+#endif /* APP_WATCHER_H */
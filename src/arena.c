@@ -0,0 +1,78 @@
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "xmalloc.h"
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	alignas(max_align_t) unsigned char data[];
+};
+
+static size_t align_up(size_t size)
+{
+	size_t align = alignof(max_align_t);
+	return (size + align - 1) & ~(align - 1);
+}
+
+void arena_init(struct arena *arena, size_t block_size)
+{
+	*arena = (struct arena) {
+		.head = NULL,
+		.block_size = block_size
+	};
+}
+
+void arena_destroy(struct arena *arena)
+{
+	struct arena_block *block = arena->head;
+	while (block != NULL) {
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->head = NULL;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	size = align_up(size);
+
+	struct arena_block *block = arena->head;
+	if (block == NULL || block->size - block->used < size) {
+		/* Oversized allocations just get a block to themselves. */
+		size_t block_size = arena->block_size;
+		if (size > block_size) {
+			block_size = size;
+		}
+		block = xmalloc(sizeof(*block) + block_size);
+		block->size = block_size;
+		block->used = 0;
+		if (block_size > arena->block_size && arena->head != NULL) {
+			/*
+			 * Keep filling the current block afterwards, rather
+			 * than wasting whatever space is left in it.
+			 */
+			block->next = arena->head->next;
+			arena->head->next = block;
+		} else {
+			block->next = arena->head;
+			arena->head = block;
+		}
+	}
+
+	void *ptr = &block->data[block->used];
+	block->used += size;
+	return ptr;
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t length)
+{
+	char *copy = arena_alloc(arena, length + 1);
+	memcpy(copy, str, length);
+	copy[length] = '\0';
+	return copy;
+}
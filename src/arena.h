@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_block;
+
+/*
+ * A simple bump allocator for data that all lives and dies together.
+ *
+ * Memory comes from a list of large blocks, so allocations are cheap and
+ * never move once made. Nothing is freed until the whole arena is destroyed.
+ */
+struct arena {
+	struct arena_block *head;
+	size_t block_size;
+};
+
+void arena_init(struct arena *arena, size_t block_size);
+void arena_destroy(struct arena *arena);
+
+[[nodiscard("memory leaked")]]
+void *arena_alloc(struct arena *arena, size_t size);
+
+[[nodiscard("memory leaked")]]
+char *arena_strndup(struct arena *arena, const char *str, size_t length);
+
+#endif /* ARENA_H */
@@ -0,0 +1,264 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "ascii_search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+typedef const char *(*strcasestr_func)(const char *, size_t, const char *, size_t);
+typedef const char *(*strcasechr_func)(const char *, size_t, char);
+
+static inline char ascii_tolower(char c)
+{
+	if (c >= 'A' && c <= 'Z') {
+		return c | 0x20;
+	}
+	return c;
+}
+
+/* Compare len bytes of s against the lowercase string lower. */
+static inline bool ascii_caseeq(const char *s, const char *lower, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (ascii_tolower(s[i]) != lower[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static const char *strcasestr_scalar(
+		const char *haystack,
+		size_t haystack_len,
+		const char *needle,
+		size_t needle_len)
+{
+	for (size_t i = 0; i + needle_len <= haystack_len; i++) {
+		if (ascii_caseeq(&haystack[i], needle, needle_len)) {
+			return &haystack[i];
+		}
+	}
+	return NULL;
+}
+
+static const char *strcasechr_scalar(const char *s, size_t len, char c)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (ascii_tolower(s[i]) == c) {
+			return &s[i];
+		}
+	}
+	return NULL;
+}
+
+#ifdef HAVE_X86
+
+/*
+ * The vector kernels below all use the same approach, from Wojciech Muła's
+ * "SIMD-friendly algorithms for substring searching". Lowercase a block of
+ * the haystack starting at each candidate position, and another starting
+ * needle_len - 1 bytes later. Positions where the first byte matches the
+ * first character of the needle and the second matches the last character
+ * are then checked in full. This rejects almost all positions sixteen or
+ * thirty-two at a time.
+ *
+ * Lowercasing relies on signed comparisons, so bytes >= 0x80 (negative)
+ * are never in the range 'A'-'Z' and are left alone.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i lower_sse2(__m128i x)
+{
+	const __m128i upper = _mm_and_si128(
+			_mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)),
+			_mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), x));
+	return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((target("sse2")))
+static const char *strcasestr_sse2(
+		const char *haystack,
+		size_t haystack_len,
+		const char *needle,
+		size_t needle_len)
+{
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+
+	size_t i = 0;
+	for (; i + needle_len - 1 + 16 <= haystack_len; i += 16) {
+		const __m128i block_first = lower_sse2(
+				_mm_loadu_si128((const __m128i *)&haystack[i]));
+		const __m128i block_last = lower_sse2(
+				_mm_loadu_si128((const __m128i *)&haystack[i + needle_len - 1]));
+		uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+					_mm_cmpeq_epi8(block_first, first),
+					_mm_cmpeq_epi8(block_last, last)));
+		while (mask != 0) {
+			const size_t pos = i + __builtin_ctz(mask);
+			if (ascii_caseeq(&haystack[pos], needle, needle_len)) {
+				return &haystack[pos];
+			}
+			mask &= mask - 1;
+		}
+	}
+	return strcasestr_scalar(&haystack[i], haystack_len - i, needle, needle_len);
+}
+
+__attribute__((target("sse2")))
+static const char *strcasechr_sse2(const char *s, size_t len, char c)
+{
+	const __m128i target = _mm_set1_epi8(c);
+
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		const __m128i block = lower_sse2(
+				_mm_loadu_si128((const __m128i *)&s[i]));
+		const uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, target));
+		if (mask != 0) {
+			return &s[i + __builtin_ctz(mask)];
+		}
+	}
+	return strcasechr_scalar(&s[i], len - i, c);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i lower_avx2(__m256i x)
+{
+	const __m256i upper = _mm256_and_si256(
+			_mm256_cmpgt_epi8(x, _mm256_set1_epi8('A' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), x));
+	return _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static const char *strcasestr_avx2(
+		const char *haystack,
+		size_t haystack_len,
+		const char *needle,
+		size_t needle_len)
+{
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+
+	size_t i = 0;
+	for (; i + needle_len - 1 + 32 <= haystack_len; i += 32) {
+		const __m256i block_first = lower_avx2(
+				_mm256_loadu_si256((const __m256i *)&haystack[i]));
+		const __m256i block_last = lower_avx2(
+				_mm256_loadu_si256((const __m256i *)&haystack[i + needle_len - 1]));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+					_mm256_cmpeq_epi8(block_first, first),
+					_mm256_cmpeq_epi8(block_last, last)));
+		while (mask != 0) {
+			const size_t pos = i + __builtin_ctz(mask);
+			if (ascii_caseeq(&haystack[pos], needle, needle_len)) {
+				return &haystack[pos];
+			}
+			mask &= mask - 1;
+		}
+	}
+	/* Finish off with SSE2, which handles anything < 32 bytes. */
+	return strcasestr_sse2(&haystack[i], haystack_len - i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static const char *strcasechr_avx2(const char *s, size_t len, char c)
+{
+	const __m256i target = _mm256_set1_epi8(c);
+
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		const __m256i block = lower_avx2(
+				_mm256_loadu_si256((const __m256i *)&s[i]));
+		const uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, target));
+		if (mask != 0) {
+			return &s[i + __builtin_ctz(mask)];
+		}
+	}
+	return strcasechr_sse2(&s[i], len - i, c);
+}
+
+#endif /* HAVE_X86 */
+
+/*
+ * Pick the best implementation for this CPU on first use. Every thread will
+ * pick the same one, so there's no harm if two threads race to do so, as long
+ * as the pointers themselves are updated atomically.
+ */
+static const char *strcasestr_resolve(const char *, size_t, const char *, size_t);
+static const char *strcasechr_resolve(const char *, size_t, char);
+
+static _Atomic strcasestr_func strcasestr_impl = strcasestr_resolve;
+static _Atomic strcasechr_func strcasechr_impl = strcasechr_resolve;
+
+static void resolve(void)
+{
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		atomic_store_explicit(&strcasestr_impl, strcasestr_avx2, memory_order_relaxed);
+		atomic_store_explicit(&strcasechr_impl, strcasechr_avx2, memory_order_relaxed);
+		return;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		atomic_store_explicit(&strcasestr_impl, strcasestr_sse2, memory_order_relaxed);
+		atomic_store_explicit(&strcasechr_impl, strcasechr_sse2, memory_order_relaxed);
+		return;
+	}
+#endif
+	atomic_store_explicit(&strcasestr_impl, strcasestr_scalar, memory_order_relaxed);
+	atomic_store_explicit(&strcasechr_impl, strcasechr_scalar, memory_order_relaxed);
+}
+
+static const char *strcasestr_resolve(
+		const char *haystack,
+		size_t haystack_len,
+		const char *needle,
+		size_t needle_len)
+{
+	resolve();
+	strcasestr_func impl = atomic_load_explicit(&strcasestr_impl, memory_order_relaxed);
+	return impl(haystack, haystack_len, needle, needle_len);
+}
+
+static const char *strcasechr_resolve(const char *s, size_t len, char c)
+{
+	resolve();
+	strcasechr_func impl = atomic_load_explicit(&strcasechr_impl, memory_order_relaxed);
+	return impl(s, len, c);
+}
+
+/*
+ * Find the first occurrence of needle in haystack, ignoring the case of
+ * haystack. Returns NULL if there isn't one.
+ */
+const char *ascii_strcasestr(
+		const char *haystack,
+		size_t haystack_len,
+		const char *needle,
+		size_t needle_len)
+{
+	if (needle_len == 0) {
+		return haystack;
+	}
+	if (needle_len > haystack_len) {
+		return NULL;
+	}
+	strcasestr_func impl = atomic_load_explicit(&strcasestr_impl, memory_order_relaxed);
+	return impl(haystack, haystack_len, needle, needle_len);
+}
+
+/*
+ * Find the first occurrence of c in s, ignoring the case of s. Returns NULL
+ * if there isn't one.
+ */
+const char *ascii_strcasechr(const char *s, size_t len, char c)
+{
+	strcasechr_func impl = atomic_load_explicit(&strcasechr_impl, memory_order_relaxed);
+	return impl(s, len, c);
+}
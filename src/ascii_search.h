@@ -0,0 +1,20 @@
+#ifndef ASCII_SEARCH_H
+#define ASCII_SEARCH_H
+
+#include <stddef.h>
+
+/*
+ * Case-insensitive ASCII search kernels, using SSE2 or AVX2 where available.
+ *
+ * The needle (or character) must already be lowercase, and lengths are given
+ * explicitly so that haystacks needn't be nul-terminated. Non-ASCII bytes
+ * never compare equal to anything except themselves.
+ */
+const char *ascii_strcasestr(
+		const char *haystack,
+		size_t haystack_len,
+		const char *needle,
+		size_t needle_len);
+const char *ascii_strcasechr(const char *s, size_t len, char c);
+
+#endif /* ASCII_SEARCH_H */
@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cache_file.h"
+#include "log.h"
+#include "mkdirp.h"
+#include "xmalloc.h"
+
+struct cache_writer cache_writer_create(size_t size)
+{
+	return (struct cache_writer) {
+		.buf = xmalloc(size),
+		.length = 0,
+		.size = size
+	};
+}
+
+void cache_writer_destroy(struct cache_writer *writer)
+{
+	free(writer->buf);
+}
+
+void cache_put(struct cache_writer *writer, const void *data, size_t length)
+{
+	if (writer->length + length > writer->size) {
+		while (writer->length + length > writer->size) {
+			writer->size *= 2;
+		}
+		writer->buf = xrealloc(writer->buf, writer->size);
+	}
+	memcpy(&writer->buf[writer->length], data, length);
+	writer->length += length;
+}
+
+void cache_put_u32(struct cache_writer *writer, uint32_t value)
+{
+	cache_put(writer, &value, sizeof(value));
+}
+
+void cache_put_u64(struct cache_writer *writer, uint64_t value)
+{
+	cache_put(writer, &value, sizeof(value));
+}
+
+void cache_put_i64(struct cache_writer *writer, int64_t value)
+{
+	cache_put(writer, &value, sizeof(value));
+}
+
+void cache_put_str(struct cache_writer *writer, const char *str)
+{
+	if (str == NULL) {
+		cache_put_u32(writer, CACHE_NULL_STRING);
+		return;
+	}
+	uint32_t length = strlen(str);
+	cache_put_u32(writer, length);
+	cache_put(writer, str, length + 1);
+}
+
+struct cache_reader cache_reader_create(const void *data, size_t length)
+{
+	return (struct cache_reader) {
+		.cursor = data,
+		.end = (const char *)data + length,
+		.ok = true
+	};
+}
+
+const void *cache_get(struct cache_reader *reader, size_t length)
+{
+	if (!reader->ok || (size_t)(reader->end - reader->cursor) < length) {
+		reader->ok = false;
+		return NULL;
+	}
+	const void *data = reader->cursor;
+	reader->cursor += length;
+	return data;
+}
+
+uint32_t cache_get_u32(struct cache_reader *reader)
+{
+	uint32_t value = 0;
+	const void *data = cache_get(reader, sizeof(value));
+	if (data != NULL) {
+		memcpy(&value, data, sizeof(value));
+	}
+	return value;
+}
+
+uint64_t cache_get_u64(struct cache_reader *reader)
+{
+	uint64_t value = 0;
+	const void *data = cache_get(reader, sizeof(value));
+	if (data != NULL) {
+		memcpy(&value, data, sizeof(value));
+	}
+	return value;
+}
+
+int64_t cache_get_i64(struct cache_reader *reader)
+{
+	int64_t value = 0;
+	const void *data = cache_get(reader, sizeof(value));
+	if (data != NULL) {
+		memcpy(&value, data, sizeof(value));
+	}
+	return value;
+}
+
+/*
+ * Returns a string pointing into the reader's data, or NULL if it was
+ * written as NULL or is malformed, which reader->ok tells apart.
+ */
+const char *cache_get_str(struct cache_reader *reader)
+{
+	uint32_t length = cache_get_u32(reader);
+	if (length == CACHE_NULL_STRING) {
+		return NULL;
+	}
+	const char *str = cache_get(reader, (size_t)length + 1);
+	if (str == NULL) {
+		return NULL;
+	}
+	if (str[length] != '\0') {
+		reader->ok = false;
+		return NULL;
+	}
+	return str;
+}
+
+/*
+ * Write out writer's contents to filename. The new file is written alongside
+ * and then renamed into place, so a concurrent reader never sees half of it.
+ * what names the cache in error messages.
+ */
+bool cache_write_file(const char *filename, const char *what, const struct cache_writer *writer)
+{
+	if (!mkdirp(filename)) {
+		return false;
+	}
+
+	size_t len = strlen(filename) + sizeof(".tmp");
+	char *tmp_name = xmalloc(len);
+	snprintf(tmp_name, len, "%s.tmp", filename);
+
+	int fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		log_error("Failed to create %s: %s.\n", what, strerror(errno));
+		free(tmp_name);
+		return false;
+	}
+
+	bool ok = true;
+	size_t written = 0;
+	while (written < writer->length) {
+		ssize_t res = write(fd, &writer->buf[written], writer->length - written);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_error("Failed to write %s: %s.\n", what, strerror(errno));
+			ok = false;
+			break;
+		}
+		written += res;
+	}
+	if (close(fd) != 0) {
+		ok = false;
+	}
+
+	if (ok && rename(tmp_name, filename) != 0) {
+		log_error("Failed to replace %s: %s.\n", what, strerror(errno));
+		ok = false;
+	}
+	if (!ok) {
+		unlink(tmp_name);
+	}
+	free(tmp_name);
+	return ok;
+}
+
+/*
+ * FNV-1a. Caches use this to tell their inputs apart, not to protect
+ * against anyone, so a fast, simple hash is all that's needed.
+ */
+uint64_t cache_hash(const void *data, size_t length)
+{
+	const unsigned char *bytes = data;
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
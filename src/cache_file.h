@@ -0,0 +1,48 @@
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Helpers for tofi's binary cache files. Integers are in native byte order,
+ * as caches never leave the machine. Strings are a 32-bit length (or
+ * CACHE_NULL_STRING) followed by the bytes and a terminating NUL, so that
+ * they can be used in place from a mapped file.
+ */
+#define CACHE_NULL_STRING UINT32_MAX
+
+struct cache_writer {
+	char *buf;
+	size_t length;
+	size_t size;
+};
+
+/* Reading past the end, or anything malformed, clears ok. */
+struct cache_reader {
+	const char *cursor;
+	const char *end;
+	bool ok;
+};
+
+[[nodiscard("memory leaked")]]
+struct cache_writer cache_writer_create(size_t size);
+void cache_writer_destroy(struct cache_writer *writer);
+void cache_put(struct cache_writer *writer, const void *data, size_t length);
+void cache_put_u32(struct cache_writer *writer, uint32_t value);
+void cache_put_u64(struct cache_writer *writer, uint64_t value);
+void cache_put_i64(struct cache_writer *writer, int64_t value);
+void cache_put_str(struct cache_writer *writer, const char *str);
+
+struct cache_reader cache_reader_create(const void *data, size_t length);
+const void *cache_get(struct cache_reader *reader, size_t length);
+uint32_t cache_get_u32(struct cache_reader *reader);
+uint64_t cache_get_u64(struct cache_reader *reader);
+int64_t cache_get_i64(struct cache_reader *reader);
+const char *cache_get_str(struct cache_reader *reader);
+
+bool cache_write_file(const char *filename, const char *what, const struct cache_writer *writer);
+uint64_t cache_hash(const void *data, size_t length);
+
+#endif /* CACHE_FILE_H */
@@ -1,23 +1,64 @@
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include "cache_file.h"
 #include "compgen.h"
 #include "history.h"
 #include "log.h"
-#include "mkdirp.h"
 #include "string_vec.h"
+#include "thread_pool.h"
 #include "xmalloc.h"
 
 static const char *default_cache_dir = ".cache";
 static const char *cache_basename = "tofi-compgen";
 
+/*
+ * The cache file is a header, then each PATH dir with its mtime and the
+ * programs in it, then the offsets of every distinct program's name in the
+ * file, in sorted order. Strings are as described in cache_file.h, so the
+ * sorted list can be used straight from the mapped file.
+ *
+ * Each value of PATH gets its own cache file, named after a hash of it, so
+ * that e.g. a shell with a different PATH doesn't invalidate everyone
+ * else's cache.
+ *
+ * Bump COMPGEN_CACHE_VERSION whenever any of this changes.
+ */
+#define COMPGEN_CACHE_MAGIC "toficgen"
+#define COMPGEN_CACHE_MAGIC_LENGTH 8
+#define COMPGEN_CACHE_VERSION 1
+
+/* One dir in PATH, and what we know about its programs. */
+struct path_dir {
+	const char *path;
+	/* -1 if the directory doesn't exist. */
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+
+	/* Whether the dir has changed since the cache was written. */
+	bool rescan;
+
+	/* Programs we've scanned for, if rescan is set. */
+	struct string_vec programs;
+
+	/* Otherwise, its records in the old cache file. */
+	const char *cached;
+	size_t cached_length;
+	uint32_t num_cached;
+};
+
 [[nodiscard("memory leaked")]]
-static char *get_cache_path() {
+static char *get_cache_path(const char *env_path) {
 	char *cache_name = NULL;
+	uint64_t hash = cache_hash(env_path, strlen(env_path));
 	const char *state_path = getenv("XDG_CACHE_HOME");
 	if (state_path == NULL) {
 		const char *home = getenv("HOME");
@@ -27,84 +68,488 @@ static char *get_cache_path() {
 		}
 		size_t len = strlen(home) + 1
 			+ strlen(default_cache_dir) + 1
-			+ strlen(cache_basename) + 1;
+			+ strlen(cache_basename) + 1
+			+ 16 + 1;
 		cache_name = xmalloc(len);
 		snprintf(
 			cache_name,
 			len,
-			"%s/%s/%s",
+			"%s/%s/%s-%016llx",
 			home,
 			default_cache_dir,
-			cache_basename);
+			cache_basename,
+			(unsigned long long)hash);
 	} else {
 		size_t len = strlen(state_path) + 1
-			+ strlen(cache_basename) + 1;
+			+ strlen(cache_basename) + 1
+			+ 16 + 1;
 		cache_name = xmalloc(len);
 		snprintf(
 			cache_name,
 			len,
-			"%s/%s",
+			"%s/%s-%016llx",
 			state_path,
-			cache_basename);
+			cache_basename,
+			(unsigned long long)hash);
 	}
 	return cache_name;
 }
 
-static void write_cache(const char *buffer, const char *filename)
+/*
+ * Split path, a copy of PATH which is modified in place, into its dirs, and
+ * note when each was last modified.
+ */
+[[nodiscard("memory leaked")]]
+static struct path_dir *split_path(char *path, size_t *num_dirs)
+{
+	size_t count = 1;
+	for (const char *c = path; *c != '\0'; c++) {
+		count += *c == ':';
+	}
+	struct path_dir *dirs = xcalloc(count, sizeof(*dirs));
+	count = 0;
+	char *saveptr = NULL;
+	char *path_entry = strtok_r(path, ":", &saveptr);
+	while (path_entry != NULL) {
+		struct stat sb;
+		bool exists = stat(path_entry, &sb) == 0;
+		dirs[count] = (struct path_dir) {
+			.path = path_entry,
+			.mtime_sec = exists ? sb.st_mtim.tv_sec : -1,
+			.mtime_nsec = exists ? sb.st_mtim.tv_nsec : 0,
+			.rescan = true
+		};
+		count++;
+		path_entry = strtok_r(NULL, ":", &saveptr);
+	}
+	*num_dirs = count;
+	return dirs;
+}
+
+static void free_path_dirs(struct path_dir *dirs, size_t num_dirs)
+{
+	for (size_t i = 0; i < num_dirs; i++) {
+		if (dirs[i].programs.buf != NULL) {
+			string_vec_destroy(&dirs[i].programs);
+		}
+	}
+	free(dirs);
+}
+
+/*
+ * Whether the entry name in dir_fd is a program we can run: a regular file
+ * that we may execute. Most of PATH is regular files and directories, whose
+ * type readdir() already tells us, so only symlinks and filesystems that
+ * don't fill in d_type need a stat to find out what they are. Either way,
+ * the execute check is the same faccessat().
+ */
+static bool is_program(int dir_fd, const char *name, unsigned char type)
 {
-	errno = 0;
-	FILE *fp = fopen(filename, "wb");
-	if (!fp) {
-		log_error("Failed to open cache file \"%s\": %s\n", filename, strerror(errno));
+	switch (type) {
+		case DT_REG:
+			break;
+		case DT_LNK:
+		case DT_UNKNOWN: {
+			struct stat sb;
+			if (fstatat(dir_fd, name, &sb, 0) == -1 || !S_ISREG(sb.st_mode)) {
+				return false;
+			}
+			break;
+		}
+		default:
+			return false;
+	}
+	return faccessat(dir_fd, name, X_OK, AT_EACCESS) == 0;
+}
+
+static void scan_path_dir(void *arg, size_t index)
+{
+	struct path_dir *dirs = arg;
+	struct path_dir *path_dir = &dirs[index];
+	if (!path_dir->rescan) {
+		return;
+	}
+	path_dir->programs = string_vec_create();
+	DIR *dir = opendir(path_dir->path);
+	if (dir == NULL) {
 		return;
 	}
-	size_t len = strlen(buffer);
-	errno = 0;
-	if (fwrite(buffer, 1, len, fp) != len) {
-		log_error("Error writing cache file \"%s\": %s\n", filename, strerror(errno));
+	int fd = dirfd(dir);
+	struct dirent *d;
+	while ((d = readdir(dir)) != NULL) {
+		if (is_program(fd, d->d_name, d->d_type)) {
+			string_vec_add(&path_dir->programs, d->d_name);
+		}
 	}
-	fclose(fp);
+	closedir(dir);
 }
 
-static char *read_cache(const char *filename)
+/*
+ * Scan every dir marked for rescanning. Directories are independent, and
+ * reading them is mostly waiting on the kernel, so scan them all at once.
+ */
+static void scan_path_dirs(struct path_dir *dirs, size_t num_dirs)
 {
-	errno = 0;
-	FILE *fp = fopen(filename, "rb");
-	if (!fp) {
-		log_error("Failed to open cache file \"%s\": %s\n", filename, strerror(errno));
-		return NULL;
-	}
-	if (fseek(fp, 0, SEEK_END)) {
-		log_error("Failed to seek in cache file: %s\n", strerror(errno));
-		fclose(fp);
-		return NULL;
-	}
-	size_t size;
-	{
-		long ssize = ftell(fp);
-		if (ssize < 0) {
-			log_error("Failed to determine cache file size: %s\n", strerror(errno));
-			fclose(fp);
-			return NULL;
+	log_debug("Scanning PATH for binaries.\n");
+	size_t num_threads = thread_pool_default_size();
+	if (num_threads > num_dirs - 1) {
+		num_threads = num_dirs - 1;
+	}
+	if (num_dirs > 1 && num_threads > 0) {
+		struct thread_pool *pool = thread_pool_create(num_threads);
+		thread_pool_run(pool, scan_path_dir, dirs, num_dirs);
+		thread_pool_destroy(pool);
+	} else {
+		for (size_t i = 0; i < num_dirs; i++) {
+			scan_path_dir(dirs, i);
+		}
+	}
+}
+
+/*
+ * Map the cache file in filename into cache, and compare it with dirs. Any
+ * dir that's unchanged has its programs pointed at the old records, and has
+ * rescan cleared.
+ *
+ * If nothing has changed, programs is filled in with every program, sorted
+ * and pointing into the mapped file, and true is returned. Otherwise, the
+ * file is left mapped for as long as dirs may need it, unless it's no use.
+ */
+static bool load_cache(
+		struct compgen_cache *cache,
+		const char *filename,
+		const char *env_path,
+		struct path_dir *dirs,
+		size_t num_dirs,
+		struct string_ref_vec *programs)
+{
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		log_debug("No compgen cache found.\n");
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_error("Failed to map compgen cache: %s.\n", strerror(errno));
+		return false;
+	}
+	cache->map = map;
+	cache->map_size = st.st_size;
+
+	struct cache_reader reader = cache_reader_create(map, st.st_size);
+	const char *magic = cache_get(&reader, COMPGEN_CACHE_MAGIC_LENGTH);
+	if (magic == NULL
+			|| memcmp(magic, COMPGEN_CACHE_MAGIC, COMPGEN_CACHE_MAGIC_LENGTH) != 0
+			|| cache_get_u32(&reader) != COMPGEN_CACHE_VERSION) {
+		log_debug("Ignoring compgen cache from a different version.\n");
+		compgen_cache_destroy(cache);
+		return false;
+	}
+	const char *cached_path = cache_get_str(&reader);
+	size_t num_cached_dirs = cache_get_u32(&reader);
+	size_t num_programs = cache_get_u32(&reader);
+	if (!reader.ok
+			|| cached_path == NULL
+			|| strcmp(cached_path, env_path) != 0
+			|| num_cached_dirs != num_dirs
+			|| num_programs > (size_t)st.st_size) {
+		log_debug("Compgen cache is for a different PATH, ignoring it.\n");
+		compgen_cache_destroy(cache);
+		return false;
+	}
+
+	bool up_to_date = true;
+	for (size_t i = 0; i < num_dirs && reader.ok; i++) {
+		struct path_dir *dir = &dirs[i];
+		int64_t mtime_sec = cache_get_i64(&reader);
+		int64_t mtime_nsec = cache_get_i64(&reader);
+		const char *path = cache_get_str(&reader);
+		uint32_t count = cache_get_u32(&reader);
+		const char *start = reader.cursor;
+		for (size_t j = 0; j < count && reader.ok; j++) {
+			if (cache_get_str(&reader) == NULL) {
+				reader.ok = false;
+			}
+		}
+		if (!reader.ok || path == NULL || strcmp(path, dir->path) != 0) {
+			reader.ok = false;
+			break;
+		}
+		if (mtime_sec == dir->mtime_sec && mtime_nsec == dir->mtime_nsec) {
+			dir->rescan = false;
+			dir->cached = start;
+			dir->cached_length = reader.cursor - start;
+			dir->num_cached = count;
+		} else {
+			log_debug("%s changed, compgen cache is stale.\n", dir->path);
+			up_to_date = false;
+		}
+	}
+	if (!reader.ok) {
+		log_error("Compgen cache is corrupt, ignoring it.\n");
+		for (size_t i = 0; i < num_dirs; i++) {
+			dirs[i].rescan = true;
+		}
+		compgen_cache_destroy(cache);
+		return false;
+	}
+	if (!up_to_date) {
+		return false;
+	}
+
+	const char *offsets = cache_get(&reader, num_programs * sizeof(uint32_t));
+	if (offsets == NULL) {
+		log_error("Compgen cache is corrupt, ignoring it.\n");
+		compgen_cache_destroy(cache);
+		return false;
+	}
+	*programs = (struct string_ref_vec) {
+		.count = 0,
+		.size = num_programs + 1,
+		.buf = xcalloc(num_programs + 1, sizeof(*programs->buf))
+	};
+	const char *base = map;
+	for (size_t i = 0; i < num_programs; i++) {
+		uint32_t offset;
+		uint32_t length;
+		memcpy(&offset, &offsets[i * sizeof(offset)], sizeof(offset));
+		if (offset < sizeof(length) || offset >= (size_t)st.st_size) {
+			reader.ok = false;
+			break;
+		}
+		memcpy(&length, &base[offset - sizeof(length)], sizeof(length));
+		if ((size_t)length >= (size_t)st.st_size - offset || base[offset + length] != '\0') {
+			reader.ok = false;
+			break;
+		}
+		/* The mapping is read-only, but nothing writes to these strings. */
+		programs->buf[programs->count].string = (char *)&base[offset];
+		programs->count++;
+	}
+	if (!reader.ok) {
+		log_error("Compgen cache is corrupt, ignoring it.\n");
+		string_ref_vec_destroy(programs);
+		compgen_cache_destroy(cache);
+		return false;
+	}
+	log_debug("Loaded %zu programs from compgen cache.\n", programs->count);
+	return true;
+}
+
+static int cmpoffsetp(const void *a, const void *b, void *arg)
+{
+	const char *base = arg;
+	uint32_t offset1 = *(const uint32_t *)a;
+	uint32_t offset2 = *(const uint32_t *)b;
+	return strcmp(&base[offset1], &base[offset2]);
+}
+
+/* Note the offset of every string in the length bytes of records at start. */
+static void add_offsets(
+		uint32_t **offsets,
+		size_t *num_offsets,
+		size_t *offsets_size,
+		size_t start,
+		const char *records,
+		uint32_t count)
+{
+	if (*num_offsets + count > *offsets_size) {
+		while (*num_offsets + count > *offsets_size) {
+			*offsets_size *= 2;
+		}
+		*offsets = xrealloc(*offsets, *offsets_size * sizeof(**offsets));
+	}
+	size_t position = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t length;
+		memcpy(&length, &records[position], sizeof(length));
+		position += sizeof(length);
+		(*offsets)[(*num_offsets)++] = start + position;
+		position += length + 1;
+	}
+}
+
+/*
+ * Write a new cache file for dirs. Unchanged dirs' records are copied
+ * straight from the old file, so only rescanned ones need encoding.
+ */
+static bool save_cache(
+		const char *filename,
+		const char *env_path,
+		const struct path_dir *dirs,
+		size_t num_dirs)
+{
+	struct cache_writer writer = cache_writer_create(64 * 1024);
+	size_t offsets_size = 1024;
+	size_t num_offsets = 0;
+	uint32_t *offsets = xmalloc(offsets_size * sizeof(*offsets));
+
+	cache_put(&writer, COMPGEN_CACHE_MAGIC, COMPGEN_CACHE_MAGIC_LENGTH);
+	cache_put_u32(&writer, COMPGEN_CACHE_VERSION);
+	cache_put_str(&writer, env_path);
+	cache_put_u32(&writer, num_dirs);
+	size_t count_position = writer.length;
+	cache_put_u32(&writer, 0);
+	for (size_t i = 0; i < num_dirs; i++) {
+		const struct path_dir *dir = &dirs[i];
+		cache_put_i64(&writer, dir->mtime_sec);
+		cache_put_i64(&writer, dir->mtime_nsec);
+		cache_put_str(&writer, dir->path);
+		size_t start;
+		if (dir->rescan) {
+			cache_put_u32(&writer, dir->programs.count);
+			start = writer.length;
+			for (size_t j = 0; j < dir->programs.count; j++) {
+				cache_put_str(&writer, dir->programs.buf[j].string);
+			}
+			add_offsets(&offsets, &num_offsets, &offsets_size,
+					start, &writer.buf[start], dir->programs.count);
+		} else {
+			cache_put_u32(&writer, dir->num_cached);
+			start = writer.length;
+			cache_put(&writer, dir->cached, dir->cached_length);
+			add_offsets(&offsets, &num_offsets, &offsets_size,
+					start, dir->cached, dir->num_cached);
+		}
+	}
+	if (writer.length > UINT32_MAX) {
+		log_error("Too many programs to cache.\n");
+		free(offsets);
+		cache_writer_destroy(&writer);
+		return false;
+	}
+
+	log_debug("Sorting results.\n");
+	qsort_r(offsets, num_offsets, sizeof(*offsets), cmpoffsetp, writer.buf);
+
+	log_debug("Making unique.\n");
+	size_t num_programs = 0;
+	for (size_t i = 0; i < num_offsets; i++) {
+		if (num_programs > 0 && !strcmp(
+					&writer.buf[offsets[num_programs - 1]],
+					&writer.buf[offsets[i]])) {
+			continue;
 		}
-		size = (size_t)ssize;
+		offsets[num_programs++] = offsets[i];
 	}
-	char *cache = xmalloc(size + 1);
-	rewind(fp);
-	if (fread(cache, 1, size, fp) != size) {
-		log_error("Failed to read cache file: %s\n", strerror(errno));
-		free(cache);
-		fclose(fp);
-		return NULL;
+	uint32_t count = num_programs;
+	memcpy(&writer.buf[count_position], &count, sizeof(count));
+	cache_put(&writer, offsets, num_programs * sizeof(*offsets));
+
+	bool ok = cache_write_file(filename, "compgen cache", &writer);
+	if (ok) {
+		log_debug("Saved %zu programs to compgen cache.\n", num_programs);
 	}
-	fclose(fp);
-	cache[size] = '\0';
+	free(offsets);
+	cache_writer_destroy(&writer);
+	return ok;
+}
 
-	return cache;
+static int cmpstrp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
 }
 
-char *compgen_cached()
+/*
+ * Build the sorted, unique list of programs in dirs without going through a
+ * cache file, for when writing or reading one back has failed. Rescanned
+ * dirs' programs are used as they are, and unchanged dirs' records are read
+ * from the old cache, which must still be mapped. Everything is copied into
+ * a new buffer, returned in buf, that the result points into.
+ */
+[[nodiscard("memory leaked")]]
+static struct string_ref_vec collect_programs(
+		const struct path_dir *dirs,
+		size_t num_dirs,
+		char **buf)
 {
+	size_t num_names = 0;
+	for (size_t i = 0; i < num_dirs; i++) {
+		num_names += dirs[i].rescan ? dirs[i].programs.count : dirs[i].num_cached;
+	}
+	char **names = xcalloc(num_names + 1, sizeof(*names));
+	size_t count = 0;
+	for (size_t i = 0; i < num_dirs; i++) {
+		const struct path_dir *dir = &dirs[i];
+		if (dir->rescan) {
+			for (size_t j = 0; j < dir->programs.count; j++) {
+				names[count++] = dir->programs.buf[j].string;
+			}
+			continue;
+		}
+		size_t position = 0;
+		for (uint32_t j = 0; j < dir->num_cached; j++) {
+			uint32_t length;
+			memcpy(&length, &dir->cached[position], sizeof(length));
+			position += sizeof(length);
+			/* The records were checked when the cache was loaded. */
+			names[count++] = (char *)&dir->cached[position];
+			position += length + 1;
+		}
+	}
+
+	log_debug("Sorting results.\n");
+	qsort(names, count, sizeof(*names), cmpstrp);
+
+	log_debug("Making unique.\n");
+	size_t num_programs = 0;
+	size_t buf_len = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (num_programs > 0 && !strcmp(names[num_programs - 1], names[i])) {
+			continue;
+		}
+		names[num_programs++] = names[i];
+		buf_len += strlen(names[i]) + 1;
+	}
+
+	struct string_ref_vec programs = {
+		.count = num_programs,
+		.size = num_programs + 1,
+		.buf = xcalloc(num_programs + 1, sizeof(*programs.buf))
+	};
+	*buf = xmalloc(buf_len + 1);
+	char *cursor = *buf;
+	for (size_t i = 0; i < num_programs; i++) {
+		size_t length = strlen(names[i]) + 1;
+		memcpy(cursor, names[i], length);
+		programs.buf[i].string = cursor;
+		cursor += length;
+	}
+	free(names);
+	return programs;
+}
+
+void compgen_cache_destroy(struct compgen_cache *cache)
+{
+	if (cache->map != NULL) {
+		munmap(cache->map, cache->map_size);
+		cache->map = NULL;
+		cache->map_size = 0;
+	}
+	free(cache->buf);
+	cache->buf = NULL;
+}
+
+/*
+ * Like compgen(), but using a cache in $XDG_CACHE_HOME, so that only PATH
+ * dirs which have changed since it was written are scanned. The result
+ * points into cache, which must be destroyed with compgen_cache_destroy()
+ * once it's no longer needed.
+ */
+struct string_ref_vec compgen_cached(struct compgen_cache *cache)
+{
+	*cache = (struct compgen_cache) {
+		.map = NULL,
+		.map_size = 0,
+		.buf = NULL
+	};
+
 	log_debug("Retrieving PATH.\n");
 	const char *env_path = getenv("PATH");
 	if (env_path == NULL) {
@@ -113,58 +558,65 @@ char *compgen_cached()
 	}
 
 	log_debug("Retrieving cache location.\n");
-	char *cache_path = get_cache_path();
-
-	struct stat sb;
+	char *cache_path = get_cache_path(env_path);
 	if (cache_path == NULL) {
-		return compgen();
-	}
-
-	/* If the cache doesn't exist, create it and return */
-	errno = 0;
-	if (stat(cache_path, &sb) == -1) {
-		if (errno == ENOENT) {
-			char *commands = compgen();
-			if (mkdirp(cache_path)) {
-				write_cache(commands, cache_path);
-			}
-			free(cache_path);
-			return commands;
-		}
-		free(cache_path);
-		return compgen();
+		cache->buf = compgen();
+		return string_ref_vec_from_buffer(cache->buf);
 	}
 
-	/* The cache exists, so check if it's still in date */
 	char *path = xstrdup(env_path);
-	char *saveptr = NULL;
-	char *path_entry = strtok_r(path, ":", &saveptr);
-	bool out_of_date = false;
-	while (path_entry != NULL) {
-		struct stat path_sb;
-		if (stat(path_entry, &path_sb) == 0) {
-			if (path_sb.st_mtim.tv_sec > sb.st_mtim.tv_sec) {
-				out_of_date = true;
-				break;
-			}
-		}
-		path_entry = strtok_r(NULL, ":", &saveptr);
-	}
-	free(path);
+	size_t num_dirs;
+	struct path_dir *dirs = split_path(path, &num_dirs);
 
-	char *commands;
-	if (out_of_date) {
+	struct string_ref_vec programs;
+	bool loaded = load_cache(cache, cache_path, env_path, dirs, num_dirs, &programs);
+	if (!loaded) {
 		log_debug("Cache out of date, updating.\n");
 		log_indent();
-		commands = compgen();
+		scan_path_dirs(dirs, num_dirs);
+		if (save_cache(cache_path, env_path, dirs, num_dirs)) {
+			/*
+			 * Read the new file back with a copy of dirs, so that
+			 * if that fails, we still have what we scanned and the
+			 * old records to fall back on.
+			 */
+			struct compgen_cache new_cache = {
+				.map = NULL,
+				.map_size = 0,
+				.buf = NULL
+			};
+			struct path_dir *new_dirs = xcalloc(num_dirs, sizeof(*new_dirs));
+			for (size_t i = 0; i < num_dirs; i++) {
+				new_dirs[i] = (struct path_dir) {
+					.path = dirs[i].path,
+					.mtime_sec = dirs[i].mtime_sec,
+					.mtime_nsec = dirs[i].mtime_nsec,
+					.rescan = true
+				};
+			}
+			loaded = load_cache(&new_cache, cache_path, env_path, new_dirs, num_dirs, &programs);
+			free(new_dirs);
+			if (loaded) {
+				/* The old records have been copied, so we're done with them. */
+				compgen_cache_destroy(cache);
+				*cache = new_cache;
+			} else {
+				compgen_cache_destroy(&new_cache);
+			}
+		}
+		if (!loaded) {
+			/* Something's gone wrong with the cache, so do without. */
+			char *buf;
+			programs = collect_programs(dirs, num_dirs, &buf);
+			compgen_cache_destroy(cache);
+			cache->buf = buf;
+		}
 		log_unindent();
-		write_cache(commands, cache_path);
-	} else {
-		log_debug("Cache up to date, loading.\n");
-		commands = read_cache(cache_path);
 	}
+	free_path_dirs(dirs, num_dirs);
+	free(path);
 	free(cache_path);
-	return commands;
+	return programs;
 }
 
 char *compgen()
@@ -176,34 +628,28 @@ char *compgen()
 		exit(EXIT_FAILURE);
 	}
 
-	struct string_vec programs = string_vec_create();
 	char *path = xstrdup(env_path);
-	char *saveptr = NULL;
-	char *path_entry = strtok_r(path, ":", &saveptr);
+	size_t num_dirs;
+	struct path_dir *dirs = split_path(path, &num_dirs);
+	scan_path_dirs(dirs, num_dirs);
 
-	log_debug("Scanning PATH for binaries.\n");
-	while (path_entry != NULL) {
-		DIR *dir = opendir(path_entry);
-		if (dir != NULL) {
-			int fd = dirfd(dir);
-			struct dirent *d;
-			while ((d = readdir(dir)) != NULL) {
-				struct stat sb;
-				if (fstatat(fd, d->d_name, &sb, 0) == -1) {
-					continue;
-				}
-				if (!(sb.st_mode & S_IXUSR)) {
-					continue;
-				}
-				if (!S_ISREG(sb.st_mode)) {
-					continue;
-				}
-				string_vec_add(&programs, d->d_name);
-			}
-			closedir(dir);
-		}
-		path_entry = strtok_r(NULL, ":", &saveptr);
+	/* Move everything into one list, without copying the strings. */
+	size_t num_programs = 0;
+	for (size_t i = 0; i < num_dirs; i++) {
+		num_programs += dirs[i].programs.count;
+	}
+	struct string_vec programs = {
+		.count = 0,
+		.size = num_programs + 1,
+		.buf = xcalloc(num_programs + 1, sizeof(*programs.buf))
+	};
+	for (size_t i = 0; i < num_dirs; i++) {
+		struct string_vec *vec = &dirs[i].programs;
+		memcpy(&programs.buf[programs.count], vec->buf, vec->count * sizeof(*vec->buf));
+		programs.count += vec->count;
+		free(vec->buf);
 	}
+	free(dirs);
 	free(path);
 
 	log_debug("Sorting results.\n");
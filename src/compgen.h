@@ -1,14 +1,24 @@
 #ifndef COMPGEN_H
 #define COMPGEN_H
 
+#include <stddef.h>
 #include "history.h"
 #include "string_vec.h"
 
+/* Whatever the strings from compgen_cached() point into. */
+struct compgen_cache {
+	void *map;
+	size_t map_size;
+	char *buf;
+};
+
 [[nodiscard("memory leaked")]]
 char *compgen(void);
 
 [[nodiscard("memory leaked")]]
-char *compgen_cached(void);
+struct string_ref_vec compgen_cached(struct compgen_cache *cache);
+
+void compgen_cache_destroy(struct compgen_cache *cache);
 
 [[nodiscard("memory leaked")]]
 struct string_ref_vec compgen_history_sort(struct string_ref_vec *programs, struct history *history);
@@ -74,7 +74,9 @@ static char *css = CSS(
 
 static bool use_history = true;
 static bool require_match = true;
-static bool fuzzy_match = true;
+static enum matching_algorithm matching_algorithm = MATCHING_ALGORITHM_FUZZY;
+/* Filter lists at least this long on all cores, 0 to disable. */
+static uint32_t parallel_filter_threshold = 20000;
 static bool multiple_instance = false;
 static int32_t exclusive_zone = -1;
 
@@ -4,6 +4,7 @@
 #include "css.h"
 #include "color.h"
 #include "log.h"
+#include "nelem.h"
 #include "theme.h"
 #include "xmalloc.h"
 #include "wlr-layer-shell-unstable-v1.h"
@@ -51,6 +52,12 @@
   | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT \
   )
 
+/* Problems found in the stylesheet being parsed, which are all logged. */
+static size_t num_errors;
+
+/* The last generation handed out by css_compile(). */
+static uint32_t last_generation;
+
 int index_of(char *str, char search)
 {
   char *ptr;
@@ -65,7 +72,9 @@ int index_of(char *str, char search)
 
 bool str_endswith(char *str, char *end)
 {
-  return strcmp(str + (strlen(str) - strlen(end)), end) == 0;
+  size_t len = strlen(str);
+  size_t end_len = strlen(end);
+  return len >= end_len && strcmp(str + (len - end_len), end) == 0;
 }
 
 bool str_startswith(char *str, char *start)
@@ -121,155 +130,228 @@ char *trim(char *str)
     return str;
 }
 
-struct css_attr *find_attr(struct css_rule *rule, char *attr_name)
+static const char *property_names[CSS_NUM_PROPERTIES] = {
+  [CSS_WIDTH] = "width",
+  [CSS_HEIGHT] = "height",
+  [CSS_SCALE] = "scale",
+  [CSS_ANCHOR] = "anchor",
+  [CSS_FONT_FAMILY] = "font-family",
+  [CSS_FONT_SIZE] = "font-size",
+  [CSS_FONT_WEIGHT] = "font-weight",
+  [CSS_FONT_STYLE] = "font-style",
+  [CSS_COLOR] = "color",
+  [CSS_BACKGROUND_COLOR] = "background-color",
+  [CSS_CONTENT] = "content",
+  [CSS_PADDING_TOP] = "padding-top",
+  [CSS_PADDING_RIGHT] = "padding-right",
+  [CSS_PADDING_BOTTOM] = "padding-bottom",
+  [CSS_PADDING_LEFT] = "padding-left",
+  [CSS_MARGIN_TOP] = "margin-top",
+  [CSS_MARGIN_RIGHT] = "margin-right",
+  [CSS_MARGIN_BOTTOM] = "margin-bottom",
+  [CSS_MARGIN_LEFT] = "margin-left",
+  [CSS_BORDER_WIDTH] = "border-width",
+  [CSS_BORDER_COLOR] = "border-color",
+  [CSS_OUTLINE_WIDTH] = "outline-width",
+  [CSS_OUTLINE_COLOR] = "outline-color",
+  [CSS_CARET_COLOR] = "caret-color",
+  [CSS_CARET_SHAPE] = "caret-shape",
+};
+
+/* The kinds of value each property takes. */
+enum css_kind {
+  CSS_KIND_COLOR,
+  CSS_KIND_LENGTH,
+  CSS_KIND_TEXT,
+  CSS_KIND_ANCHOR,
+  CSS_KIND_SHAPE
+};
+
+static const enum css_kind property_kinds[CSS_NUM_PROPERTIES] = {
+  [CSS_WIDTH] = CSS_KIND_LENGTH,
+  [CSS_HEIGHT] = CSS_KIND_LENGTH,
+  [CSS_SCALE] = CSS_KIND_LENGTH,
+  [CSS_ANCHOR] = CSS_KIND_ANCHOR,
+  [CSS_FONT_FAMILY] = CSS_KIND_TEXT,
+  [CSS_FONT_SIZE] = CSS_KIND_LENGTH,
+  [CSS_FONT_WEIGHT] = CSS_KIND_TEXT,
+  [CSS_FONT_STYLE] = CSS_KIND_TEXT,
+  [CSS_COLOR] = CSS_KIND_COLOR,
+  [CSS_BACKGROUND_COLOR] = CSS_KIND_COLOR,
+  [CSS_CONTENT] = CSS_KIND_TEXT,
+  [CSS_PADDING_TOP] = CSS_KIND_LENGTH,
+  [CSS_PADDING_RIGHT] = CSS_KIND_LENGTH,
+  [CSS_PADDING_BOTTOM] = CSS_KIND_LENGTH,
+  [CSS_PADDING_LEFT] = CSS_KIND_LENGTH,
+  [CSS_MARGIN_TOP] = CSS_KIND_LENGTH,
+  [CSS_MARGIN_RIGHT] = CSS_KIND_LENGTH,
+  [CSS_MARGIN_BOTTOM] = CSS_KIND_LENGTH,
+  [CSS_MARGIN_LEFT] = CSS_KIND_LENGTH,
+  [CSS_BORDER_WIDTH] = CSS_KIND_LENGTH,
+  [CSS_BORDER_COLOR] = CSS_KIND_COLOR,
+  [CSS_OUTLINE_WIDTH] = CSS_KIND_LENGTH,
+  [CSS_OUTLINE_COLOR] = CSS_KIND_COLOR,
+  [CSS_CARET_COLOR] = CSS_KIND_COLOR,
+  [CSS_CARET_SHAPE] = CSS_KIND_SHAPE,
+};
+
+static const char *kind_names[] = {
+  [CSS_KIND_COLOR] = "a color",
+  [CSS_KIND_LENGTH] = "a length",
+  [CSS_KIND_TEXT] = "text",
+  [CSS_KIND_ANCHOR] = "an anchor",
+  [CSS_KIND_SHAPE] = "a shape",
+};
+
+/* Whether a value written with unit is the right kind for property. */
+static bool kind_accepts(enum css_property property, enum unit unit)
 {
-  for (int i = 0; i < rule->count; i++) {
-    struct css_attr *attr = &rule->attrs[i];
-    if (str_equals(attr->name, attr_name)) {
-      return attr;
-    }
+  switch (property_kinds[property]) {
+    case CSS_KIND_COLOR:
+      return unit == HEX_COLOR;
+    case CSS_KIND_LENGTH:
+      return unit == PX || unit == EM || unit == INT || unit == PERCENT;
+    case CSS_KIND_TEXT:
+      return unit == TEXT || unit == LITERAL || unit == INT;
+    case CSS_KIND_ANCHOR:
+      return unit == LITERAL;
+    case CSS_KIND_SHAPE:
+      return unit == SHAPE;
   }
-  return NULL;
+  return false;
 }
 
-enum shape css_get_attr_shape(struct css_rule *rule, char *attr_name)
+const char *css_property_name(enum css_property property)
 {
-  struct css_attr *attr = find_attr(rule, attr_name);
-  if (attr == NULL) {
-    log_debug("rule does not have attr '%s'\n", attr_name);
-    log_debug("attrs available: %d\n", rule->count);
-    for (int i = 0; i < rule->count; i++) {
-      log_debug("%d: %s\n", i, rule->attrs[i].name);
-    }
-    exit(-1);
-  }
-
-  if (attr->unit != SHAPE) {
-    log_debug("cannot convert type '%d' to shape (%s: %s)\n", attr->unit, attr->name, attr->value);
-    exit(-1);
-  }
-
-  enum shape shape = atoi(attr->value);
-  return shape;
+  return property_names[property];
 }
 
-struct directional css_get_attr_dir(struct css_rule *rule, char *attr_name)
+/* Returns CSS_NUM_PROPERTIES for names we don't know. */
+enum css_property css_property_from_name(char *name)
 {
-  if (str_equals(attr_name, "padding")) {
-    struct directional dir = {
-      .left = css_get_attr_int(rule, "padding-left"),
-      .bottom = css_get_attr_int(rule, "padding-bottom"),
-      .top = css_get_attr_int(rule, "padding-top"),
-      .right = css_get_attr_int(rule, "padding-right")
-    };
-    return dir;
+  for (int i = 0; i < CSS_NUM_PROPERTIES; i++) {
+    if (str_equals(name, (char *)property_names[i])) {
+      return i;
+    }
   }
+  return CSS_NUM_PROPERTIES;
 }
 
-struct color css_get_attr_color(struct css_rule *rule, char *attr_name)
+/*
+ * The getters below return zero values (e.g. a transparent color or an
+ * empty string) for attributes the rule doesn't set.
+ */
+enum shape css_get_attr_shape(const struct css_rule *rule, enum css_property property)
 {
-  struct css_attr *attr = find_attr(rule, attr_name);
-  if (attr == NULL) {
-    log_debug("rule '%s' does not have attr '%s'\n", rule->selector.str_repr, attr_name);
-    log_debug("available attrs: %d\n", rule->count);
-    exit(-1);
-  }
-
-  if (attr->unit != HEX_COLOR) {
-    log_debug("cannot convert type '%d' to color (%s: %s)\n", attr->unit, attr->name, attr->value);
-    exit(-1);
-  }
-  struct color color = hex_to_color(attr->value);
-  return color;
+  return rule->attrs[property].shape;
 }
 
-char *css_get_attr_str(struct css_rule *rule, char *attr_name)
+struct directional css_get_attr_padding(const struct css_rule *rule)
 {
-  struct css_attr *attr = find_attr(rule, attr_name);
-  if (attr == NULL) {
-    log_debug("rule does not have attr '%s'\n", attr_name);
-    exit(-1);
-  }
-
-  return attr->value;
-
+  return (struct directional) {
+    .top = rule->attrs[CSS_PADDING_TOP].number,
+    .right = rule->attrs[CSS_PADDING_RIGHT].number,
+    .bottom = rule->attrs[CSS_PADDING_BOTTOM].number,
+    .left = rule->attrs[CSS_PADDING_LEFT].number
+  };
 }
 
-int css_get_attr_int(struct css_rule *rule, char *attr_name)
+struct color css_get_attr_color(const struct css_rule *rule, enum css_property property)
 {
-  struct css_attr *attr = find_attr(rule, attr_name);
-  if (attr == NULL) {
-    return 0;
-  }
+  return rule->attrs[property].color;
+}
 
-  if (attr->unit == LITERAL && str_equals(attr->name, "anchor")) {
-    if (str_equals(attr->value, "center")) {
-      return ANCHOR_CENTER;
-    } else if (str_equals(attr->value, "top")) {
-      return ANCHOR_TOP;
-    } else if (str_equals(attr->value, "left")) {
-      return ANCHOR_LEFT;
-    } else if (str_equals(attr->value, "top-left")) {
-      return ANCHOR_TOP_LEFT;
-    } else if (str_equals(attr->value, "right")) {
-      return ANCHOR_RIGHT;
-    } else if (str_equals(attr->value, "top-right")) {
-      return ANCHOR_TOP_RIGHT;
-    } else if (str_equals(attr->value, "bottom")) {
-      return ANCHOR_BOTTOM;
-    } else if (str_equals(attr->value, "bottom-left")) {
-      return ANCHOR_BOTTOM_LEFT;
-    } else if (str_equals(attr->value, "bottom-right")) {
-      return ANCHOR_BOTTOM_RIGHT;
-    } else {
-      log_debug("unknown value for anchor '%s'\n", attr->value);
-      exit(-1);
-    }
-  }
+char *css_get_attr_str(const struct css_rule *rule, enum css_property property)
+{
+  const struct css_attr *attr = &rule->attrs[property];
+  return attr->set ? attr->value : "";
+}
 
-  int value = atoi(attr->value);
+int css_get_attr_int(const struct css_rule *rule, enum css_property property)
+{
+  return rule->attrs[property].number;
+}
 
-  if (attr->unit == EM) {
-    value *= 24;
+/* Returns -1 for values we don't know. */
+int css_decode_anchor(char *value)
+{
+  if (str_equals(value, "center")) {
+    return ANCHOR_CENTER;
+  } else if (str_equals(value, "top")) {
+    return ANCHOR_TOP;
+  } else if (str_equals(value, "left")) {
+    return ANCHOR_LEFT;
+  } else if (str_equals(value, "top-left")) {
+    return ANCHOR_TOP_LEFT;
+  } else if (str_equals(value, "right")) {
+    return ANCHOR_RIGHT;
+  } else if (str_equals(value, "top-right")) {
+    return ANCHOR_TOP_RIGHT;
+  } else if (str_equals(value, "bottom")) {
+    return ANCHOR_BOTTOM;
+  } else if (str_equals(value, "bottom-left")) {
+    return ANCHOR_BOTTOM_LEFT;
+  } else if (str_equals(value, "bottom-right")) {
+    return ANCHOR_BOTTOM_RIGHT;
+  } else {
+    return -1;
   }
-
-  return value;
-
 }
 
-
-bool selector_match(struct css_selector *rule_selector,
-    struct css_selector *query_selector)
+bool css_decode_shape(char *value, enum shape *shape)
 {
-
-  if (!str_equals(rule_selector->element, query_selector->element)) {
+  if (str_equals(value, "bar")) {
+    *shape = BAR;
+  } else if (str_equals(value, "block")) {
+    *shape = BLOCK;
+  } else if (str_equals(value, "underscore")) {
+    *shape = UNDERSCORE;
+  } else {
     return false;
   }
+  return true;
+}
 
-  if (rule_selector->pseudo_element != NULL && strlen(rule_selector->pseudo_element) > 0) {
-    if (!str_equals(rule_selector->pseudo_element, query_selector->pseudo_element)) {
-      return false;
-    }
+/*
+ * Work out the typed value of an attr, so the getters don't have to.
+ * Returns false if the value isn't valid.
+ */
+bool css_decode_attr(enum css_property property, struct css_attr *attr)
+{
+  switch (attr->unit) {
+    case HEX_COLOR:
+      attr->color = hex_to_color(attr->value);
+      /* hex_to_color() returns a negative color for bad input. */
+      return attr->color.a >= 0;
+    case SHAPE:
+      return css_decode_shape(attr->value, &attr->shape);
+    case LITERAL:
+      if (property == CSS_ANCHOR) {
+        attr->number = css_decode_anchor(attr->value);
+        return attr->number != -1;
+      }
+      break;
+    case EM:
+      attr->number = atoi(attr->value) * 24;
+      break;
+    case TEXT:
+      break;
+    default:
+      attr->number = atoi(attr->value);
+      break;
   }
-
   return true;
 }
 
-void css_rule_apply_attr(struct css_rule *rule, struct css_attr *attr)
+
+/* Apply every attr that source sets to rule, overriding what's there. */
+void css_rule_apply_attrs(struct css_rule *rule, const struct css_rule *source)
 {
-  for (int i = 0; i < rule->count; i++) {
-    struct css_attr *attr_o = &rule->attrs[i];
-    if (strcmp(attr_o->name, attr->name) == 0) {
-      attr_o->value = attr->value;
-      attr_o->unit = attr->unit;
-      return;
+  for (int i = 0; i < CSS_NUM_PROPERTIES; i++) {
+    if (source->attrs[i].set) {
+      rule->attrs[i] = source->attrs[i];
     }
   }
-  struct css_attr *attr_o = &rule->attrs[rule->count];
-  attr_o->name = attr->name;
-  attr_o->value = attr->value;
-  attr_o->unit = attr->unit;
-  rule->count++;
 }
 
 char *css_extract_element(char *query) {
@@ -331,7 +413,7 @@ char *css_extract_class(char *query, int *pos) {
 
   start += *pos;
   start++;
-  str = str + start;
+  str = query + start;
 
   if (str[0] == ':') {
     return NULL;
@@ -366,8 +448,11 @@ struct css_classes css_extract_classes(char *query) {
       break;
     }
     count++;
-    if (count >= 9)
-      exit(0);
+    if (count == N_ELEM(classes.classes) - 1) {
+      num_errors++;
+      log_error("Too many classes in '%s', ignoring the rest.\n", query);
+      break;
+    }
   }
 
   return classes;
@@ -423,33 +508,252 @@ struct css_classes css_extract_pseudo_classes(char *query) {
   return classes;
 }
 
-struct css_rule css_select(struct css *css, char *query)
+/*
+ * The bit for a class in selectors, or 0 if no selector uses it, in which
+ * case having the class makes no difference.
+ */
+uint64_t css_class_bit(const struct css *css, const char *name)
+{
+  for (size_t i = 0; i < css->num_classes; i++) {
+    if (strcmp(css->class_names[i], name) == 0) {
+      return (uint64_t)1 << i;
+    }
+  }
+  return 0;
+}
+
+uint64_t css_classes_mask(const struct css *css, const struct css_classes *classes)
+{
+  uint64_t mask = 0;
+  for (size_t i = 0; i < N_ELEM(classes->classes) && classes->classes[i] != NULL; i++) {
+    mask |= css_class_bit(css, classes->classes[i]);
+  }
+  return mask;
+}
+
+/* Give a class a bit, if it doesn't have one yet. */
+static uint64_t intern_class(struct css *css, const char *name)
+{
+  uint64_t bit = css_class_bit(css, name);
+  if (bit != 0) {
+    return bit;
+  }
+  if (css->num_classes == CSS_MAX_CLASSES) {
+    num_errors++;
+    log_error("Too many CSS classes, ignoring rules using '%s'.\n", name);
+    /* No set of classes has this bit, so the rule never matches. */
+    return (uint64_t)1 << CSS_MAX_CLASSES;
+  }
+  css->class_names[css->num_classes] = xstrdup(name);
+  return (uint64_t)1 << css->num_classes++;
+}
+
+static struct css_bucket *find_bucket(const struct css *css, const char *element)
+{
+  for (size_t i = 0; i < css->num_buckets; i++) {
+    if (str_equals(css->buckets[i].element, (char *)element)) {
+      return &css->buckets[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Later rules override earlier ones, so more specific rules go last, and
+ * rules that are as specific as each other stay in the order they were
+ * written.
+ */
+static int cmp_rules(const void *a, const void *b)
+{
+  const struct css_rule *rule1 = *(const struct css_rule **)a;
+  const struct css_rule *rule2 = *(const struct css_rule **)b;
+  if (rule1->selector.specificity != rule2->selector.specificity) {
+    return rule1->selector.specificity - rule2->selector.specificity;
+  }
+  return (rule1 > rule2) - (rule1 < rule2);
+}
+
+/*
+ * Work out the style of element (and pseudo_element, which may be NULL) for
+ * an element with the given classes. A rule without a pseudo-element also
+ * applies to its element's pseudo-elements.
+ */
+static struct css_rule css_resolve(
+    const struct css *css,
+    const char *element,
+    const char *pseudo_element,
+    uint64_t classes)
 {
   struct css_rule rule = {
-    .selector = {
-      .element = css_extract_element(query),
-      .pseudo_element = css_extract_pseudo_element(query),
-      .classes = css_extract_classes(query),
-      .pseudo_classes = css_extract_pseudo_classes(query),
-      .str_repr = query
-    },
-    .count = 0,
-    .size = 128,
-    .attrs = xcalloc(128, sizeof(struct css_attr*))
+    .attrs = {{ 0 }}
   };
-
-  for (int i = 0; i < css->count; i++) {
-    struct css_rule *rule_o = &css->rules[i];
-    if (selector_match(&rule_o->selector, &rule.selector)) {
-      for (int j = 0; j < rule_o->count; j++) {
-        struct css_attr *attr = &rule_o->attrs[j];
-        css_rule_apply_attr(&rule, attr);
+  const struct css_bucket *bucket = find_bucket(css, element);
+  if (bucket == NULL) {
+    return rule;
+  }
+  for (size_t i = 0; i < bucket->count; i++) {
+    const struct css_rule *rule_o = bucket->rules[i];
+    const struct css_selector *selector = &rule_o->selector;
+    if (selector->pseudo_element != NULL && strlen(selector->pseudo_element) > 0) {
+      if (!str_equals(selector->pseudo_element, (char *)pseudo_element)) {
+        continue;
       }
     }
+    if ((selector->class_mask & ~classes) != 0) {
+      continue;
+    }
+    css_rule_apply_attrs(&rule, rule_o);
   }
+  return rule;
+}
 
+struct css_rule css_select(struct css *css, char *query)
+{
+  struct css_selector selector = {
+    .element = css_extract_element(query),
+    .pseudo_element = css_extract_pseudo_element(query),
+    .classes = css_extract_classes(query),
+    .pseudo_classes = css_extract_pseudo_classes(query),
+    .str_repr = query
+  };
+  struct css_rule rule = css_resolve(
+      css,
+      selector.element,
+      selector.pseudo_element,
+      css_classes_mask(css, &selector.classes));
+  rule.selector = selector;
   return rule;
+}
+
+static char *style_selectors[CSS_NUM_STYLES] = {
+  [CSS_STYLE_WINDOW] = "window",
+  [CSS_STYLE_BODY] = "body",
+  [CSS_STYLE_INPUT] = "input",
+  [CSS_STYLE_INPUT_BEFORE] = "input::before",
+  [CSS_STYLE_INPUT_PLACEHOLDER] = "input::placeholder",
+  [CSS_STYLE_ENTRY] = "entry",
+  [CSS_STYLE_ENTRY_BEFORE] = "entry::before",
+};
+
+/*
+ * Index the rules by element, most specific last, with their classes as bit
+ * masks. Then resolve every selector tofi draws with against the stylesheet,
+ * so that looking up a style while drawing is just indexing into a table.
+ */
+void css_compile(struct css *css)
+{
+  for (size_t i = 0; i < css->count; i++) {
+    struct css_rule *rule = &css->rules[i];
+    struct css_selector *selector = &rule->selector;
+    selector->class_mask = 0;
+    size_t num_classes = 0;
+    while (num_classes < N_ELEM(selector->classes.classes)
+        && selector->classes.classes[num_classes] != NULL) {
+      selector->class_mask |= intern_class(css, selector->classes.classes[num_classes]);
+      num_classes++;
+    }
+    selector->specificity = 10 * num_classes;
+    if (selector->pseudo_element != NULL && strlen(selector->pseudo_element) > 0) {
+      selector->specificity += 1;
+    }
+
+    struct css_bucket *bucket = find_bucket(css, selector->element);
+    if (bucket == NULL) {
+      css->buckets = xrealloc(css->buckets, (css->num_buckets + 1) * sizeof(*css->buckets));
+      bucket = &css->buckets[css->num_buckets++];
+      *bucket = (struct css_bucket) {
+        .element = selector->element,
+        .count = 0,
+        .rules = NULL
+      };
+    }
+    bucket->rules = xrealloc(bucket->rules, (bucket->count + 1) * sizeof(*bucket->rules));
+    bucket->rules[bucket->count++] = rule;
+  }
+  for (size_t i = 0; i < css->num_buckets; i++) {
+    struct css_bucket *bucket = &css->buckets[i];
+    qsort(bucket->rules, bucket->count, sizeof(*bucket->rules), cmp_rules);
+  }
 
+  for (int i = 0; i < CSS_NUM_STYLES; i++) {
+    css->styles[i] = css_select(css, style_selectors[i]);
+  }
+  css->selected_class = css_class_bit(css, "selected");
+  css->generation = ++last_generation;
+}
+
+const struct css_rule *css_style(const struct css *css, enum css_style_id id)
+{
+  return &css->styles[id];
+}
+
+static size_t class_style_slot(enum css_style_id id, uint64_t classes, size_t size)
+{
+  uint64_t hash = (classes ^ ((uint64_t)id << 58)) * UINT64_C(0x9e3779b97f4a7c15);
+  return (size_t)(hash >> 32) & (size - 1);
+}
+
+/* Move the class styles into a table twice the size. */
+static void grow_class_styles(struct css *css)
+{
+  size_t old_size = css->class_styles_size;
+  struct css_class_style **old = css->class_styles;
+  css->class_styles_size = old_size == 0 ? 16 : 2 * old_size;
+  css->class_styles = xcalloc(css->class_styles_size, sizeof(*css->class_styles));
+  for (size_t i = 0; i < old_size; i++) {
+    struct css_class_style *style = old[i];
+    if (style == NULL) {
+      continue;
+    }
+    size_t slot = class_style_slot(style->id, style->classes, css->class_styles_size);
+    while (css->class_styles[slot] != NULL) {
+      slot = (slot + 1) & (css->class_styles_size - 1);
+    }
+    css->class_styles[slot] = style;
+  }
+  free(old);
+}
+
+/*
+ * The style for an element with a set of classes, as from
+ * css_classes_mask(). Each set of classes is only resolved the first time
+ * it's asked for, so this is cheap enough to call for every row drawn.
+ */
+const struct css_rule *css_style_with_classes(
+    struct css *css,
+    enum css_style_id id,
+    uint64_t classes)
+{
+  if (classes == 0) {
+    return &css->styles[id];
+  }
+  if (2 * (css->num_class_styles + 1) > css->class_styles_size) {
+    grow_class_styles(css);
+  }
+  size_t slot = class_style_slot(id, classes, css->class_styles_size);
+  while (css->class_styles[slot] != NULL) {
+    struct css_class_style *style = css->class_styles[slot];
+    if (style->id == id && style->classes == classes) {
+      return &style->rule;
+    }
+    slot = (slot + 1) & (css->class_styles_size - 1);
+  }
+
+  const struct css_rule *base = &css->styles[id];
+  struct css_class_style *style = xmalloc(sizeof(*style));
+  *style = (struct css_class_style) {
+    .id = id,
+    .classes = classes,
+    .rule = css_resolve(
+        css,
+        base->selector.element,
+        base->selector.pseudo_element,
+        classes)
+  };
+  style->rule.selector = base->selector;
+  css->class_styles[slot] = style;
+  css->num_class_styles++;
+  return &style->rule;
 }
 
 char *css_substring(char *data, int *pos, char delimiter)
@@ -461,14 +765,9 @@ char *css_substring(char *data, int *pos, char delimiter)
     return NULL;
   }
 
-  if (index == 0)
-  {
-    return "";
-  }
-
   *pos += index + 1;
 
-  char *sub = (char *)xmalloc(sizeof(char) * index);
+  char *sub = (char *)xmalloc(sizeof(char) * (index + 1));
   strncpy(sub, str, index);
   sub[index] = '\0';
   trim(sub);
@@ -484,9 +783,19 @@ void parse_selector(char *data, struct css_selector *selector){
   selector->str_repr = data;
 }
 
-void rule_add_attr_v(struct css_rule *rule, char *name, char *value)
+/*
+ * Set property from value, checking that it's valid. Invalid values are
+ * reported and ignored, rather than stopping us from showing anything.
+ */
+bool rule_add_attr_v(struct css_rule *rule, enum css_property property, char *value)
 {
-  struct css_attr *attr = &rule->attrs[rule->count];
+  struct css_attr *attr = &rule->attrs[property];
+  *attr = (struct css_attr) { .set = true };
+
+  /* Shorthands share their value between attrs, so work on a copy. */
+  const char *written = value;
+  value = xstrdup(value);
+  attr->value = value;
 
   if (str_endswith(value, "px")) {
     attr->unit = PX;
@@ -498,14 +807,14 @@ void rule_add_attr_v(struct css_rule *rule, char *name, char *value)
     int len = strlen(value);
     value[len-1] = '\0';
     value[len-2] = '\0';
-  } else if (str_endswith(name, "-shape")) {
+  } else if (property_kinds[property] == CSS_KIND_SHAPE) {
     attr->unit = SHAPE;
   } else if (str_startswith(value, "#")) {
     attr->unit = HEX_COLOR;
   } else if (str_startswith(value, "\"") && str_endswith(value, "\"")) {
     attr->unit = TEXT;
     value[strlen(value)-1] = '\0';
-    value++;
+    memmove(value, value + 1, strlen(value));
   } else if (strspn(value, "-+0123456789")) {
     attr->unit = INT;
   } else if (strspn(value, "-+0123456789%")) {
@@ -513,75 +822,88 @@ void rule_add_attr_v(struct css_rule *rule, char *name, char *value)
   } else if (strspn(value, "abcdefghijklmnopqrstuvwxyz")) {
     attr->unit = LITERAL;
   } else {
-    log_debug("Could not recognize type of value '%s'\n", value);
-    exit(-1);
+    attr->set = false;
   }
 
-  size_t size_name = strlen(name) + 1;
-  attr->name = xmalloc(sizeof(char) * size_name);
-  strncpy(attr->name, name, size_name);
-  attr->name[size_name] = '\0';
-
-  size_t size_value = strlen(value) + 1;
-  attr->value = xmalloc(sizeof(char) * size_value);
-  strncpy(attr->value, value, size_value);
-  attr->value[size_value] = '\0';
+  if (attr->set && !kind_accepts(property, attr->unit)) {
+    num_errors++;
+    log_error(
+        "Expected %s for %s in '%s', got '%s', ignoring it.\n",
+        kind_names[property_kinds[property]],
+        css_property_name(property),
+        rule->selector.str_repr,
+        written);
+    free(value);
+    *attr = (struct css_attr) { .set = false };
+    return false;
+  }
+  if (!attr->set || !css_decode_attr(property, attr)) {
+    num_errors++;
+    log_error(
+        "Invalid value '%s' for %s in '%s', ignoring it.\n",
+        value,
+        css_property_name(property),
+        rule->selector.str_repr);
+    free(value);
+    *attr = (struct css_attr) { .set = false };
+    return false;
+  }
+  return true;
+}
 
-  rule->count++;
+/* Split value in two at its first space. */
+void split_pair(char *value, char **first, char **second)
+{
+  int index_space = index_of(value, ' ');
+  if (index_space < 0) {
+    *first = value;
+    *second = value + strlen(value);
+    return;
+  }
+  value[index_space] = '\0';
+  *first = value;
+  *second = value + index_space + 1;
 }
 
-void rule_add_attr(struct css_rule *rule, struct css_attr *attr)
+void rule_add_attr(struct css_rule *rule, char *name, char *value)
 {
-  char *name = attr->name;
-  char *value = attr->value;
+  char *first;
+  char *second;
   if (str_equals(name, "padding")) {
-    rule_add_attr_v(rule, "padding-left", value);
-    rule_add_attr_v(rule, "padding-bottom", value);
-    rule_add_attr_v(rule, "padding-top", value);
-    rule_add_attr_v(rule, "padding-right", value);
+    if (rule_add_attr_v(rule, CSS_PADDING_LEFT, value)) {
+      rule_add_attr_v(rule, CSS_PADDING_BOTTOM, value);
+      rule_add_attr_v(rule, CSS_PADDING_TOP, value);
+      rule_add_attr_v(rule, CSS_PADDING_RIGHT, value);
+    }
   } else if (str_equals(name, "caret")) {
-    int index_space = index_of(value, ' ');
-    char *shape = value + index_space + 1;
-    value[index_space] = '\0';
-    char *color = value;
-
-    size_t color_name_size = strlen(name) + strlen("-color") + 1;
-    char color_name [color_name_size];
-    sprintf(color_name, "%s-color", name);
-
-    size_t shape_name_size = strlen(name) + strlen("-shape") + 1;
-    char shape_name [shape_name_size];
-    sprintf(shape_name, "%s-shape", name);
-
-    rule_add_attr_v(rule, color_name, color);
-    rule_add_attr_v(rule, shape_name, shape);
-  } else if (str_equals(name, "border") || str_equals(name, "outline")) {
-    int index_space = index_of(value, ' ');
-    char *color = value + index_space + 1;
-    value[index_space] = '\0';
-    char *width = value;
-
-    size_t color_name_size = strlen(name) + strlen("-color") + 1;
-    char color_name [color_name_size];
-    sprintf(color_name, "%s-color", name);
-
-    size_t width_name_size = strlen(name) + strlen("-width") + 1;
-    char width_name [width_name_size];
-    sprintf(width_name, "%s-width", name);
-
-    rule_add_attr_v(rule, color_name, color);
-    rule_add_attr_v(rule, width_name, width);
+    split_pair(value, &first, &second);
+    rule_add_attr_v(rule, CSS_CARET_COLOR, first);
+    rule_add_attr_v(rule, CSS_CARET_SHAPE, second);
+  } else if (str_equals(name, "border")) {
+    split_pair(value, &first, &second);
+    rule_add_attr_v(rule, CSS_BORDER_WIDTH, first);
+    rule_add_attr_v(rule, CSS_BORDER_COLOR, second);
+  } else if (str_equals(name, "outline")) {
+    split_pair(value, &first, &second);
+    rule_add_attr_v(rule, CSS_OUTLINE_WIDTH, first);
+    rule_add_attr_v(rule, CSS_OUTLINE_COLOR, second);
   } else {
-    rule_add_attr_v(rule, name, value);
+    enum css_property property = css_property_from_name(name);
+    if (property == CSS_NUM_PROPERTIES) {
+      num_errors++;
+      log_error("Unknown CSS attribute '%s', ignoring it.\n", name);
+      return;
+    }
+    rule_add_attr_v(rule, property, value);
   }
 
 }
 
-void parse_attr(char *data, struct css_attr *attr)
+void parse_attr(char *data, char **name, char **value)
 {
   int pos = 0;
-  attr->name = css_substring(data, &pos, ':');
-  attr->value = css_substring(data, &pos, '\0');
+  *name = css_substring(data, &pos, ':');
+  *value = css_substring(data, &pos, '\0');
 }
 
 bool parse_rule(char *data, int *pos, struct css_rule *rule)
@@ -595,24 +917,44 @@ bool parse_rule(char *data, int *pos, struct css_rule *rule)
 
   int curr_pos = 0;
   char *selector_str = css_substring(str, &curr_pos, '{');
+  if (selector_str == NULL || curr_pos > rule_len) {
+    num_errors++;
+    log_error("Expected '{' before '}' in stylesheet, ignoring the rest.\n");
+    free(selector_str);
+    return false;
+  }
   parse_selector(selector_str, &rule->selector);
-  rule->count = 0;
-  rule->size = 128;
-  rule->attrs = xmalloc(rule->size * sizeof(struct css_rule*));
+  for (int i = 0; i < CSS_NUM_PROPERTIES; i++) {
+    rule->attrs[i] = (struct css_attr) { .set = false };
+  }
 
 
-  while (true) {
+  while (curr_pos < rule_len) {
     int next_pos = curr_pos;
     char *attr = css_substring(str, &next_pos, ';');
-    if (attr == NULL || next_pos >= rule_len) {
-      break;
+    if (attr == NULL || next_pos > rule_len) {
+      /* The last attr doesn't need a ';' after it. */
+      free(attr);
+      next_pos = curr_pos;
+      attr = css_substring(str, &next_pos, '}');
     }
 
-    struct css_attr parsed_attr;
-    parse_attr(attr, &parsed_attr);
-    rule_add_attr(rule, &parsed_attr);
+    char *name;
+    char *value;
+    parse_attr(attr, &name, &value);
+    if (name != NULL && value != NULL) {
+      rule_add_attr(rule, name, value);
+    } else if (strlen(attr) > 0) {
+      num_errors++;
+      log_error(
+          "Expected 'name: value' in '%s', got '%s', ignoring it.\n",
+          rule->selector.str_repr,
+          attr);
+    }
 
     curr_pos = next_pos;
+    free(name);
+    free(value);
     free(attr);
   }
 
@@ -626,11 +968,22 @@ struct css css_parse(char *data)
   struct css css = {
     .count = 0,
     .size = 128,
-    .rules = xmalloc(css.size * sizeof(struct css_rule))
+    .rules = xmalloc(css.size * sizeof(struct css_rule)),
+    .num_classes = 0,
+    .num_buckets = 0,
+    .buckets = NULL,
+    .num_class_styles = 0,
+    .class_styles_size = 0,
+    .class_styles = NULL
   };
 
+  num_errors = 0;
   int curr_char = 0;
   while (true) {
+    if (css.count == css.size) {
+      css.size *= 2;
+      css.rules = xrealloc(css.rules, css.size * sizeof(struct css_rule));
+    }
     bool res = parse_rule(data, &curr_char, &css.rules[css.count]);
     if (!res) {
       break;
@@ -639,6 +992,57 @@ struct css css_parse(char *data)
     css.count++;
   }
 
+  css_compile(&css);
+  css.num_errors = num_errors;
   return css;
 
 }
+
+static void free_classes(struct css_classes *classes)
+{
+  for (size_t i = 0; i < N_ELEM(classes->classes); i++) {
+    free((char *)classes->classes[i]);
+  }
+}
+
+static void free_selector(struct css_selector *selector)
+{
+  free(selector->element);
+  free(selector->pseudo_element);
+  free_classes(&selector->classes);
+  free_classes(&selector->pseudo_classes);
+}
+
+void css_destroy(struct css *css)
+{
+  for (size_t i = 0; i < css->count; i++) {
+    struct css_rule *rule = &css->rules[i];
+    free(rule->selector.str_repr);
+    free_selector(&rule->selector);
+    for (int j = 0; j < CSS_NUM_PROPERTIES; j++) {
+      if (rule->attrs[j].set) {
+        free(rule->attrs[j].value);
+      }
+    }
+  }
+  free(css->rules);
+
+  /*
+   * The computed styles share their attrs' values with the rules, and their
+   * selectors' strings (other than str_repr) are their own.
+   */
+  for (int i = 0; i < CSS_NUM_STYLES; i++) {
+    free_selector(&css->styles[i].selector);
+  }
+  for (size_t i = 0; i < css->class_styles_size; i++) {
+    free(css->class_styles[i]);
+  }
+  free(css->class_styles);
+  for (size_t i = 0; i < css->num_buckets; i++) {
+    free(css->buckets[i].rules);
+  }
+  free(css->buckets);
+  for (size_t i = 0; i < css->num_classes; i++) {
+    free(css->class_names[i]);
+  }
+}
@@ -1,8 +1,11 @@
 #ifndef CSS_H
 #define CSS_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include "color.h"
+#include "theme.h"
 
 enum unit { EM, PX, HEX_COLOR, TEXT, LITERAL, INT, PERCENT, SHAPE };
 
@@ -12,6 +15,13 @@ enum shape {
   UNDERSCORE
 };
 
+/*
+ * Classes used in selectors are given a bit each, so that matching a set of
+ * classes against a selector is a single mask test. Selectors using more
+ * classes than this never match.
+ */
+#define CSS_MAX_CLASSES 63
+
 struct css_classes {
   const char *classes[10];
 };
@@ -22,32 +32,144 @@ struct css_selector {
   char *pseudo_element;
   struct css_classes classes;
   struct css_classes pseudo_classes;
+  /* Filled in by css_compile(). */
+  uint64_t class_mask;
+  int specificity;
+};
+
+/*
+ * Every attribute tofi understands. Names are looked up once, when the
+ * stylesheet is parsed, and from then on attributes are found by indexing.
+ * Shorthands like padding and border are split into these as they're parsed.
+ */
+enum css_property {
+  CSS_WIDTH,
+  CSS_HEIGHT,
+  CSS_SCALE,
+  CSS_ANCHOR,
+  CSS_FONT_FAMILY,
+  CSS_FONT_SIZE,
+  CSS_FONT_WEIGHT,
+  CSS_FONT_STYLE,
+  CSS_COLOR,
+  CSS_BACKGROUND_COLOR,
+  CSS_CONTENT,
+  CSS_PADDING_TOP,
+  CSS_PADDING_RIGHT,
+  CSS_PADDING_BOTTOM,
+  CSS_PADDING_LEFT,
+  CSS_MARGIN_TOP,
+  CSS_MARGIN_RIGHT,
+  CSS_MARGIN_BOTTOM,
+  CSS_MARGIN_LEFT,
+  CSS_BORDER_WIDTH,
+  CSS_BORDER_COLOR,
+  CSS_OUTLINE_WIDTH,
+  CSS_OUTLINE_COLOR,
+  CSS_CARET_COLOR,
+  CSS_CARET_SHAPE,
+  CSS_NUM_PROPERTIES
 };
 
+/*
+ * An attribute's value, decoded when it's parsed. Which of the typed fields
+ * is meaningful depends on unit: color for HEX_COLOR, shape for SHAPE, and
+ * number for everything else, with lengths in pixels and anchors as
+ * layer-shell anchor flags. value is always the text as written.
+ */
 struct css_attr {
-  char *name;
-  char *value;
+  bool set;
   enum unit unit;
+  char *value;
+  struct color color;
+  enum shape shape;
+  int number;
 };
 
 struct css_rule {
   struct css_selector selector;
-  struct css_attr *attrs;
+  struct css_attr attrs[CSS_NUM_PROPERTIES];
+};
+
+/*
+ * The selectors tofi draws with. Their styles are worked out once, when the
+ * stylesheet is compiled, rather than every time something is drawn.
+ */
+enum css_style_id {
+  CSS_STYLE_WINDOW,
+  CSS_STYLE_BODY,
+  CSS_STYLE_INPUT,
+  CSS_STYLE_INPUT_BEFORE,
+  CSS_STYLE_INPUT_PLACEHOLDER,
+  CSS_STYLE_ENTRY,
+  CSS_STYLE_ENTRY_BEFORE,
+  CSS_NUM_STYLES
+};
+
+/* The rules for one element, in the order they should be applied. */
+struct css_bucket {
+  char *element;
   size_t count;
-  size_t size;
+  struct css_rule **rules;
+};
+
+/* A style computed for an element with a particular set of classes. */
+struct css_class_style {
+  enum css_style_id id;
+  uint64_t classes;
+  struct css_rule rule;
 };
 
 struct css {
   size_t count;
   size_t size;
   struct css_rule *rules;
+  /* The computed style for each css_style_id, without any classes. */
+  struct css_rule styles[CSS_NUM_STYLES];
+
+  /* Every class used in a selector, by bit. */
+  size_t num_classes;
+  char *class_names[CSS_MAX_CLASSES];
+  /* The bit for the selected row, or 0 if no rule uses it. */
+  uint64_t selected_class;
+  /*
+   * Different for every compiled stylesheet, so that anything holding on to
+   * class bits can tell when they're stale.
+   */
+  uint32_t generation;
+
+  size_t num_buckets;
+  struct css_bucket *buckets;
+
+  /*
+   * Styles computed so far for sets of classes, as they're asked for. This
+   * is a hash table of class_styles_size (a power of two) slots, kept at
+   * most half full.
+   */
+  size_t num_class_styles;
+  size_t class_styles_size;
+  struct css_class_style **class_styles;
+
+  /* How many problems css_parse() found and ignored. */
+  size_t num_errors;
 };
 
-struct directional css_get_attr_dir(struct css_rule *css_rule, char *attr_name);
-struct color css_get_attr_color(struct css_rule *css_rule, char *attr_name);
-char *css_get_attr_str(struct css_rule *css_rule, char *attr_name);
-int css_get_attr_int(struct css_rule *css_rule, char *attr_name);
+const char *css_property_name(enum css_property property);
+struct directional css_get_attr_padding(const struct css_rule *css_rule);
+struct color css_get_attr_color(const struct css_rule *css_rule, enum css_property property);
+char *css_get_attr_str(const struct css_rule *css_rule, enum css_property property);
+int css_get_attr_int(const struct css_rule *css_rule, enum css_property property);
+enum shape css_get_attr_shape(const struct css_rule *css_rule, enum css_property property);
 struct css_rule css_select(struct css *css, char *selector);
+const struct css_rule *css_style(const struct css *css, enum css_style_id id);
+uint64_t css_class_bit(const struct css *css, const char *name);
+uint64_t css_classes_mask(const struct css *css, const struct css_classes *classes);
+const struct css_rule *css_style_with_classes(
+    struct css *css,
+    enum css_style_id id,
+    uint64_t classes);
+void css_compile(struct css *css);
 struct css css_parse(char *data);
+void css_destroy(struct css *css);
 
 #endif /* CSS_H */
@@ -0,0 +1,333 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache_file.h"
+#include "css_cache.h"
+#include "log.h"
+#include "nelem.h"
+#include "xmalloc.h"
+
+static const char *default_cache_dir = ".cache";
+static const char *cache_basename = "tofi-css";
+static const char *default_config_dir = ".config";
+static const char *style_basename = "tofi/style.css";
+
+/*
+ * The cache holds the last stylesheet to be parsed, as its rules with every
+ * value already decoded, so that loading it is just copying them out. It's
+ * keyed by a hash of the stylesheet's text, so editing the stylesheet (or
+ * switching to another one) means it's parsed again.
+ *
+ * The format is as described in cache_file.h. Colors are stored as they are
+ * in memory, so bump CSS_CACHE_VERSION whenever struct css_attr or enum
+ * css_property change, as well as when this format does. Cached values
+ * aren't checked again, so bump it when the parser gets stricter too.
+ */
+#define CSS_CACHE_MAGIC "tofi-css"
+#define CSS_CACHE_MAGIC_LENGTH 8
+#define CSS_CACHE_VERSION 3
+
+/* Returns a copy of the next string, which may be NULL. */
+[[nodiscard("memory leaked")]]
+static char *get_str(struct cache_reader *reader)
+{
+  const char *str = cache_get_str(reader);
+  return str == NULL ? NULL : xstrdup(str);
+}
+
+/* $base/$name, where base is an XDG variable or default_dir in $HOME. */
+[[nodiscard("memory leaked")]]
+static char *xdg_path(const char *variable, const char *default_dir, const char *name)
+{
+  char *path = NULL;
+  const char *base = getenv(variable);
+  if (base == NULL) {
+    const char *home = getenv("HOME");
+    if (home == NULL) {
+      log_error("Couldn't retrieve HOME from environment.\n");
+      return NULL;
+    }
+    size_t len = strlen(home) + 1
+      + strlen(default_dir) + 1
+      + strlen(name) + 1;
+    path = xmalloc(len);
+    snprintf(path, len, "%s/%s/%s", home, default_dir, name);
+  } else {
+    size_t len = strlen(base) + 1
+      + strlen(name) + 1;
+    path = xmalloc(len);
+    snprintf(path, len, "%s/%s", base, name);
+  }
+  return path;
+}
+
+/* Where tofi looks for a stylesheet if none is given. */
+char *css_default_path(void)
+{
+  return xdg_path("XDG_CONFIG_HOME", default_config_dir, style_basename);
+}
+
+static void put_classes(struct cache_writer *writer, const struct css_classes *classes)
+{
+  uint32_t count = 0;
+  while (count < N_ELEM(classes->classes) && classes->classes[count] != NULL) {
+    count++;
+  }
+  cache_put_u32(writer, count);
+  for (uint32_t i = 0; i < count; i++) {
+    cache_put_str(writer, classes->classes[i]);
+  }
+}
+
+static void get_classes(struct cache_reader *reader, struct css_classes *classes)
+{
+  uint32_t count = cache_get_u32(reader);
+  if (count >= N_ELEM(classes->classes)) {
+    reader->ok = false;
+    return;
+  }
+  for (uint32_t i = 0; i < count && reader->ok; i++) {
+    classes->classes[i] = get_str(reader);
+  }
+}
+
+static void save_cache(const struct css *css, const char *filename, uint64_t hash)
+{
+  struct cache_writer writer = cache_writer_create(4096);
+  cache_put(&writer, CSS_CACHE_MAGIC, CSS_CACHE_MAGIC_LENGTH);
+  cache_put_u32(&writer, CSS_CACHE_VERSION);
+  cache_put_u64(&writer, hash);
+  cache_put_u32(&writer, css->count);
+  for (size_t i = 0; i < css->count; i++) {
+    const struct css_rule *rule = &css->rules[i];
+    cache_put_str(&writer, rule->selector.str_repr);
+    cache_put_str(&writer, rule->selector.element);
+    cache_put_str(&writer, rule->selector.pseudo_element);
+    put_classes(&writer, &rule->selector.classes);
+    put_classes(&writer, &rule->selector.pseudo_classes);
+
+    uint32_t num_attrs = 0;
+    for (int j = 0; j < CSS_NUM_PROPERTIES; j++) {
+      num_attrs += rule->attrs[j].set;
+    }
+    cache_put_u32(&writer, num_attrs);
+    for (int j = 0; j < CSS_NUM_PROPERTIES; j++) {
+      const struct css_attr *attr = &rule->attrs[j];
+      if (!attr->set) {
+        continue;
+      }
+      cache_put_u32(&writer, j);
+      cache_put_u32(&writer, attr->unit);
+      cache_put_str(&writer, attr->value);
+      cache_put(&writer, &attr->color, sizeof(attr->color));
+      cache_put_u32(&writer, attr->shape);
+      cache_put_u32(&writer, (uint32_t)attr->number);
+    }
+  }
+  if (cache_write_file(filename, "CSS cache", &writer)) {
+    log_debug("Saved compiled stylesheet to %s.\n", filename);
+  }
+  cache_writer_destroy(&writer);
+}
+
+/*
+ * Fill in css from the cache in filename, if it was compiled from the
+ * stylesheet with this hash.
+ */
+static bool load_cache(struct css *css, const char *filename, uint64_t hash)
+{
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    log_debug("No CSS cache found.\n");
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+
+  struct cache_reader reader = cache_reader_create(map, st.st_size);
+  const char *magic = cache_get(&reader, CSS_CACHE_MAGIC_LENGTH);
+  if (magic == NULL
+      || memcmp(magic, CSS_CACHE_MAGIC, CSS_CACHE_MAGIC_LENGTH) != 0
+      || cache_get_u32(&reader) != CSS_CACHE_VERSION
+      || cache_get_u64(&reader) != hash) {
+    log_debug("CSS cache is out of date.\n");
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  uint32_t count = cache_get_u32(&reader);
+  /* Every rule takes up more than a byte, which bounds a bad count. */
+  if (count > (size_t)(reader.end - reader.cursor)) {
+    reader.ok = false;
+    count = 0;
+  }
+  *css = (struct css) {
+    .count = 0,
+    .size = count > 0 ? count : 1,
+    .num_classes = 0,
+    .num_buckets = 0,
+    .buckets = NULL,
+    .num_class_styles = 0,
+    .class_styles_size = 0,
+    .class_styles = NULL,
+    .num_errors = 0
+  };
+  css->rules = xcalloc(css->size, sizeof(*css->rules));
+  for (uint32_t i = 0; i < count && reader.ok; i++) {
+    struct css_rule *rule = &css->rules[i];
+    css->count++;
+    rule->selector.str_repr = get_str(&reader);
+    rule->selector.element = get_str(&reader);
+    rule->selector.pseudo_element = get_str(&reader);
+    get_classes(&reader, &rule->selector.classes);
+    get_classes(&reader, &rule->selector.pseudo_classes);
+
+    uint32_t num_attrs = cache_get_u32(&reader);
+    for (uint32_t j = 0; j < num_attrs && reader.ok; j++) {
+      uint32_t property = cache_get_u32(&reader);
+      uint32_t unit = cache_get_u32(&reader);
+      char *value = get_str(&reader);
+      const void *color = cache_get(&reader, sizeof(struct color));
+      uint32_t shape = cache_get_u32(&reader);
+      uint32_t number = cache_get_u32(&reader);
+      if (!reader.ok
+          || value == NULL
+          || property >= CSS_NUM_PROPERTIES
+          || rule->attrs[property].set) {
+        reader.ok = false;
+        free(value);
+        break;
+      }
+      struct css_attr *attr = &rule->attrs[property];
+      *attr = (struct css_attr) {
+        .set = true,
+        .unit = unit,
+        .value = value,
+        .shape = shape,
+        .number = (int32_t)number
+      };
+      memcpy(&attr->color, color, sizeof(attr->color));
+    }
+  }
+  munmap(map, st.st_size);
+
+  if (!reader.ok) {
+    log_error("CSS cache %s is corrupt, ignoring it.\n", filename);
+    css_destroy(css);
+    return false;
+  }
+  css_compile(css);
+  return true;
+}
+
+/*
+ * Blank out comments, which the parser doesn't know about, leaving anything
+ * in quotes alone.
+ */
+static void strip_comments(char *data)
+{
+  bool quoted = false;
+  for (char *c = data; *c != '\0'; c++) {
+    if (*c == '"') {
+      quoted = !quoted;
+    } else if (!quoted && c[0] == '/' && c[1] == '*') {
+      char *end = strstr(c + 2, "*/");
+      char *stop = end != NULL ? end + 2 : c + strlen(c);
+      memset(c, ' ', stop - c);
+      c = stop - 1;
+    }
+  }
+}
+
+/*
+ * Load the stylesheet in data, which needn't be NUL-terminated. It's only
+ * parsed if the cache was compiled from something else, and the result is
+ * cached for next time if it parsed cleanly, so that any problems keep
+ * being reported until they're fixed.
+ */
+struct css css_load(const char *data, size_t length)
+{
+  struct css css;
+  uint64_t hash = cache_hash(data, length);
+  char *cache_path = xdg_path("XDG_CACHE_HOME", default_cache_dir, cache_basename);
+  if (cache_path != NULL && load_cache(&css, cache_path, hash)) {
+    log_debug("Loaded compiled stylesheet from %s.\n", cache_path);
+    free(cache_path);
+    return css;
+  }
+
+  char *buf = xmalloc(length + 1);
+  memcpy(buf, data, length);
+  buf[length] = '\0';
+  strip_comments(buf);
+  css = css_parse(buf);
+  free(buf);
+
+  if (cache_path != NULL && css.num_errors == 0) {
+    save_cache(&css, cache_path, hash);
+  }
+  free(cache_path);
+  return css;
+}
+
+/*
+ * Load the stylesheet in the file at path into css, layered over the one in
+ * defaults, so that anything it doesn't set keeps its default. Returns
+ * false, leaving css alone, if the file can't be read.
+ */
+bool css_load_file(struct css *css, const char *path, const char *defaults)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    log_debug("Couldn't open stylesheet %s: %s.\n", path, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    log_error("Couldn't stat stylesheet %s: %s.\n", path, strerror(errno));
+    close(fd);
+    return false;
+  }
+  size_t defaults_length = strlen(defaults);
+  if (st.st_size == 0) {
+    close(fd);
+    *css = css_load(defaults, defaults_length);
+    return true;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    log_error("Couldn't map stylesheet %s: %s.\n", path, strerror(errno));
+    return false;
+  }
+  log_debug("Loading stylesheet %s.\n", path);
+
+  /*
+   * Later rules win over earlier ones that are as specific, so putting the
+   * defaults first is all the layering needs.
+   */
+  size_t length = defaults_length + 1 + st.st_size;
+  char *data = xmalloc(length);
+  memcpy(data, defaults, defaults_length);
+  data[defaults_length] = '\n';
+  memcpy(&data[defaults_length + 1], map, st.st_size);
+  munmap(map, st.st_size);
+
+  *css = css_load(data, length);
+  free(data);
+  return true;
+}
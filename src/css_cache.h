@@ -0,0 +1,14 @@
+#ifndef CSS_CACHE_H
+#define CSS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "css.h"
+
+struct css css_load(const char *data, size_t length);
+bool css_load_file(struct css *css, const char *path, const char *defaults);
+
+[[nodiscard("memory leaked")]]
+char *css_default_path(void);
+
+#endif /* CSS_CACHE_H */
@@ -0,0 +1,211 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "daemon.h"
+#include "log.h"
+#include "xmalloc.h"
+
+/*
+ * In daemon mode, tofi stays running with everything loaded and its window
+ * hidden, listening on a Unix socket. Each connection to the socket shows the
+ * window once, and whatever would have been printed to stdout is written
+ * back down the connection instead, which is then closed.
+ *
+ * This means the client needs no protocol of its own: connecting is the
+ * request, and the reply is the output. The one exception is a client that
+ * arrives while the window is already showing, which is sent a lone NUL byte
+ * (something tofi never prints) to tell it to carry on without us.
+ */
+
+static const char *socket_filename = "tofi-drun.sock";
+static const char *lock_filename = "tofi-drun.lock";
+
+[[nodiscard("memory leaked")]]
+static char *get_runtime_path(const char *filename)
+{
+	const char *runtime_path = getenv("XDG_RUNTIME_DIR");
+	if (runtime_path == NULL) {
+		return NULL;
+	}
+	size_t len = strlen(runtime_path) + 1
+		+ strlen(filename) + 1;
+	char *path = xmalloc(len);
+	snprintf(
+		path,
+		len,
+		"%s/%s",
+		runtime_path,
+		filename);
+	return path;
+}
+
+/*
+ * Take the daemon lock, which is held for as long as the daemon runs. We
+ * can't just try connecting to the socket to see if there's a daemon, as
+ * that would look like a request to show the window.
+ */
+static bool take_lock(void)
+{
+	char *path = get_runtime_path(lock_filename);
+	int fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	free(path);
+	if (fd == -1) {
+		log_error("Failed to open daemon lock file: %s.\n", strerror(errno));
+		return false;
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		close(fd);
+		return false;
+	}
+	/* Deliberately left open, so the lock goes when we do. */
+	return true;
+}
+
+static bool make_address(struct sockaddr_un *addr, const char *path)
+{
+	*addr = (struct sockaddr_un) { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		log_error("Socket path %s is too long.\n", path);
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+/* Connect to the daemon's socket, returning -1 if there's no daemon. */
+static int daemon_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	if (!make_address(&addr, path)) {
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Create the daemon's listening socket. Returns -1 if that's not possible,
+ * including if another daemon is already listening.
+ */
+int daemon_listen(void)
+{
+	char *path = get_runtime_path(socket_filename);
+	if (path == NULL) {
+		log_error("XDG_RUNTIME_DIR isn't set, can't run as a daemon.\n");
+		return -1;
+	}
+	if (!take_lock()) {
+		log_error("A tofi daemon is already running.\n");
+		free(path);
+		return -1;
+	}
+
+	struct sockaddr_un addr;
+	if (!make_address(&addr, path)) {
+		free(path);
+		return -1;
+	}
+	/* Nobody's listening, so anything left here is from a dead daemon. */
+	unlink(path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd == -1) {
+		log_error("Failed to create socket: %s.\n", strerror(errno));
+		free(path);
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1
+			|| listen(fd, 8) == -1) {
+		log_error("Failed to listen on %s: %s.\n", path, strerror(errno));
+		close(fd);
+		free(path);
+		return -1;
+	}
+	log_debug("Listening on %s.\n", path);
+	free(path);
+	return fd;
+}
+
+/* Accept a pending client, returning -1 if there isn't one. */
+int daemon_accept(int listen_fd)
+{
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		log_error("Failed to accept connection: %s.\n", strerror(errno));
+	}
+	return fd;
+}
+
+/* Tell a client that we're busy with another one, and hang up. */
+void daemon_turn_away(int fd)
+{
+	if (write(fd, "", 1) != 1) {
+		log_debug("Failed to turn away client: %s.\n", strerror(errno));
+	}
+	close(fd);
+}
+
+void daemon_close(int listen_fd)
+{
+	close(listen_fd);
+	char *path = get_runtime_path(socket_filename);
+	if (path != NULL) {
+		unlink(path);
+		free(path);
+	}
+}
+
+/*
+ * If a daemon is running, have it show the window, and copy its output to
+ * stdout. Returns false if there's no daemon, or it's busy with another
+ * client, in which case we should just carry on as normal.
+ */
+bool daemon_client_run(void)
+{
+	char *path = get_runtime_path(socket_filename);
+	if (path == NULL) {
+		return false;
+	}
+	int fd = daemon_connect(path);
+	free(path);
+	if (fd == -1) {
+		return false;
+	}
+	log_debug("Connected to tofi daemon.\n");
+
+	char buf[4096];
+	bool first = true;
+	while (true) {
+		ssize_t res = read(fd, buf, sizeof(buf));
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			break;
+		}
+		if (first && buf[0] == '\0') {
+			log_debug("Tofi daemon is busy.\n");
+			close(fd);
+			return false;
+		}
+		first = false;
+		fwrite(buf, 1, res, stdout);
+	}
+	close(fd);
+	return true;
+}
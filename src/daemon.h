@@ -0,0 +1,12 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+
+int daemon_listen(void);
+int daemon_accept(int listen_fd);
+void daemon_turn_away(int fd);
+void daemon_close(int listen_fd);
+bool daemon_client_run(void);
+
+#endif /* DAEMON_H */
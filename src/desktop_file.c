@@ -0,0 +1,288 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "desktop_file.h"
+#include "desktop_vec.h"
+#include "unicode.h"
+#include "xmalloc.h"
+
+/*
+ * A minimal parser for the [Desktop Entry] group of a .desktop file.
+ *
+ * GKeyFile builds a tree of every group, key and translation in the file,
+ * then each lookup walks it again. We only ever want a handful of keys from
+ * one group, so instead make a single pass over the file, remembering where
+ * the best value for each key is, and stop as soon as the group ends. Nothing
+ * is allocated until we copy out the values we're keeping.
+ */
+
+enum key {
+	KEY_NAME,
+	KEY_ICON,
+	KEY_KEYWORDS,
+	KEY_HIDDEN,
+	KEY_NO_DISPLAY,
+	KEY_ONLY_SHOW_IN,
+	KEY_NOT_SHOW_IN,
+	NUM_KEYS
+};
+
+static const struct {
+	const char *name;
+	size_t length;
+	/* Whether to look at translations, like g_key_file_get_locale_string(). */
+	bool localised;
+} keys[NUM_KEYS] = {
+	[KEY_NAME] = { "Name", 4, true },
+	[KEY_ICON] = { "Icon", 4, true },
+	[KEY_KEYWORDS] = { "Keywords", 8, true },
+	[KEY_HIDDEN] = { "Hidden", 6, false },
+	[KEY_NO_DISPLAY] = { "NoDisplay", 9, false },
+	[KEY_ONLY_SHOW_IN] = { "OnlyShowIn", 10, false },
+	[KEY_NOT_SHOW_IN] = { "NotShowIn", 9, false },
+};
+
+/* The best value seen so far for a key. Lower ranks are better matches. */
+struct value {
+	const char *str;
+	size_t length;
+	size_t rank;
+};
+
+static bool is_space(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static int find_key(const char *key, size_t length)
+{
+	for (int i = 0; i < NUM_KEYS; i++) {
+		if (keys[i].length == length && memcmp(keys[i].name, key, length) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * How well locale matches the user's languages, which are in order of
+ * preference. Returns SIZE_MAX if it doesn't match at all.
+ */
+static size_t locale_rank(
+		const char *locale,
+		size_t length,
+		const char *const *languages)
+{
+	for (size_t i = 0; languages[i] != NULL; i++) {
+		if (strncmp(languages[i], locale, length) == 0 && languages[i][length] == '\0') {
+			return i;
+		}
+	}
+	return SIZE_MAX;
+}
+
+/* Copy a string value, handling the escapes GKeyFile does. */
+[[nodiscard("memory leaked")]]
+static char *unescape(const char *str, size_t length)
+{
+	char *res = xmalloc(length + 1);
+	char *out = res;
+	for (size_t i = 0; i < length; i++) {
+		if (str[i] != '\\' || i + 1 == length) {
+			*out++ = str[i];
+			continue;
+		}
+		i++;
+		switch (str[i]) {
+			case 's':
+				*out++ = ' ';
+				break;
+			case 'n':
+				*out++ = '\n';
+				break;
+			case 't':
+				*out++ = '\t';
+				break;
+			case 'r':
+				*out++ = '\r';
+				break;
+			case '\\':
+				*out++ = '\\';
+				break;
+			default:
+				/* Leave list separators and the like alone. */
+				*out++ = '\\';
+				*out++ = str[i];
+				break;
+		}
+	}
+	*out = '\0';
+	return res;
+}
+
+/* Returns NULL for missing or invalid values, like GKeyFile. */
+[[nodiscard("memory leaked")]]
+static char *get_string(const struct value *value)
+{
+	if (value->str == NULL) {
+		return NULL;
+	}
+	char *str = unescape(value->str, value->length);
+	if (!utf8_validate(str)) {
+		free(str);
+		return NULL;
+	}
+	return str;
+}
+
+static bool get_boolean(const struct value *value)
+{
+	if (value->str == NULL) {
+		return false;
+	}
+	return (value->length == 4 && memcmp(value->str, "true", 4) == 0)
+		|| (value->length == 1 && value->str[0] == '1');
+}
+
+/* Note the value on a "key[locale]=value" line, if it's one we want. */
+static void parse_key_value(
+		struct value values[NUM_KEYS],
+		const char *line,
+		const char *end,
+		size_t num_languages,
+		const char *const *languages)
+{
+	const char *equals = memchr(line, '=', end - line);
+	if (equals == NULL) {
+		return;
+	}
+	const char *key_end = equals;
+	while (key_end > line && is_space(key_end[-1])) {
+		key_end--;
+	}
+
+	const char *locale = NULL;
+	size_t locale_length = 0;
+	if (key_end > line && key_end[-1] == ']') {
+		locale = memchr(line, '[', key_end - line);
+		if (locale == NULL) {
+			return;
+		}
+		locale_length = key_end - locale - 2;
+		key_end = locale;
+		locale++;
+	}
+
+	int key = find_key(line, key_end - line);
+	if (key < 0) {
+		return;
+	}
+
+	size_t rank;
+	if (locale == NULL) {
+		/* Untranslated values are the fallback for localised keys. */
+		rank = keys[key].localised ? num_languages : 0;
+	} else if (keys[key].localised) {
+		rank = locale_rank(locale, locale_length, languages);
+		if (rank == SIZE_MAX) {
+			return;
+		}
+	} else {
+		return;
+	}
+	if (rank > values[key].rank) {
+		return;
+	}
+
+	const char *value = equals + 1;
+	while (value < end && is_space(*value)) {
+		value++;
+	}
+	/* Later duplicates replace earlier ones, as in GKeyFile. */
+	values[key] = (struct value) {
+		.str = value,
+		.length = end - value,
+		.rank = rank
+	};
+}
+
+/*
+ * Parse the length bytes of a .desktop file in buf into info, in the same way
+ * as desktop_info_load(). Localised keys are matched against languages, a
+ * NULL-terminated list in order of preference, as from
+ * g_get_language_names().
+ */
+bool desktop_file_parse(
+		struct desktop_info *info,
+		const char *buf,
+		size_t length,
+		const char *const *languages)
+{
+	*info = (struct desktop_info) { 0 };
+
+	size_t num_languages = 0;
+	while (languages[num_languages] != NULL) {
+		num_languages++;
+	}
+
+	struct value values[NUM_KEYS];
+	for (size_t i = 0; i < NUM_KEYS; i++) {
+		values[i] = (struct value) { .str = NULL, .length = 0, .rank = SIZE_MAX };
+	}
+
+	const char *group = "[Desktop Entry]";
+	size_t group_length = strlen(group);
+	bool in_group = false;
+	const char *cursor = buf;
+	const char *buf_end = buf + length;
+	while (cursor < buf_end) {
+		const char *line = cursor;
+		const char *end = memchr(cursor, '\n', buf_end - cursor);
+		if (end == NULL) {
+			end = buf_end;
+			cursor = buf_end;
+		} else {
+			cursor = end + 1;
+		}
+		if (end > line && end[-1] == '\r') {
+			end--;
+		}
+		while (line < end && is_space(*line)) {
+			line++;
+		}
+		if (line == end || *line == '#') {
+			continue;
+		}
+		if (*line == '[') {
+			if (in_group) {
+				/* Everything else is in other groups. */
+				break;
+			}
+			in_group = (size_t)(end - line) >= group_length
+				&& memcmp(line, group, group_length) == 0;
+			continue;
+		}
+		if (in_group) {
+			parse_key_value(values, line, end, num_languages, languages);
+		}
+	}
+
+	/* Hidden apps are never shown, so don't bother with anything else. */
+	info->hidden = get_boolean(&values[KEY_HIDDEN])
+		|| get_boolean(&values[KEY_NO_DISPLAY]);
+	if (info->hidden) {
+		return true;
+	}
+
+	info->name = get_string(&values[KEY_NAME]);
+	if (info->name == NULL) {
+		return false;
+	}
+	info->icon = get_string(&values[KEY_ICON]);
+	info->keywords = get_string(&values[KEY_KEYWORDS]);
+	info->only_show_in = get_string(&values[KEY_ONLY_SHOW_IN]);
+	info->not_show_in = get_string(&values[KEY_NOT_SHOW_IN]);
+	return true;
+}
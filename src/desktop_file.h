@@ -0,0 +1,14 @@
+#ifndef DESKTOP_FILE_H
+#define DESKTOP_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "desktop_vec.h"
+
+bool desktop_file_parse(
+		struct desktop_info *info,
+		const char *buf,
+		size_t length,
+		const char *const *languages);
+
+#endif /* DESKTOP_FILE_H */
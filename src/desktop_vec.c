@@ -1,5 +1,13 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arena.h"
+#include "desktop_file.h"
 #include "desktop_vec.h"
 #include "fuzzy_match.h"
 #include "icon.h"
@@ -9,7 +17,7 @@
 #include "unicode.h"
 #include "xmalloc.h"
 
-static bool match_current_desktop(char * const *desktop_list, gsize length);
+static bool match_current_desktop(const char *desktop_list);
 
 [[nodiscard("memory leaked")]]
 struct desktop_vec desktop_vec_create(void)
@@ -18,7 +26,12 @@ struct desktop_vec desktop_vec_create(void)
 		.count = 0,
 		.size = 128,
 		.buf = xcalloc(128, sizeof(*vec.buf)),
+		.entries = NULL,
+		.name_signatures = NULL,
+		.keywords_signatures = NULL,
+		.history_scores = NULL,
 	};
+	arena_init(&vec.arena, 64 * 1024);
 	return vec;
 }
 
@@ -26,12 +39,93 @@ void desktop_vec_destroy(struct desktop_vec *restrict vec)
 {
 	for (size_t i = 0; i < vec->count; i++) {
 		free(vec->buf[i].id);
-		free(vec->buf[i].name);
 		free(vec->buf[i].path);
-		free(vec->buf[i].keywords);
+		if (vec->entries == NULL) {
+			/* Otherwise, these have been moved into the arena. */
+			free(vec->buf[i].name);
+			free(vec->buf[i].keywords);
+		}
     icon_destroy(&vec->buf[i].icon);
 	}
 	free(vec->buf);
+	arena_destroy(&vec->arena);
+}
+
+static char *arena_move(struct arena *arena, char *str)
+{
+	char *copy = arena_strndup(arena, str, strlen(str));
+	free(str);
+	return copy;
+}
+
+/*
+ * The CSS class of an app's entry, its id without ".desktop" and with dots
+ * (which can't be used in a class name) replaced by dashes, so that e.g.
+ * org.gnome.Nautilus.desktop can be styled with "entry.org-gnome-Nautilus".
+ */
+static const char *app_class(struct arena *arena, const char *id)
+{
+	if (id == NULL) {
+		return NULL;
+	}
+	const char *suffix = ".desktop";
+	size_t len = strlen(id);
+	size_t suffix_len = strlen(suffix);
+	if (len > suffix_len && strcmp(id + len - suffix_len, suffix) == 0) {
+		len -= suffix_len;
+	}
+	char *class = arena_strndup(arena, id, len);
+	for (char *c = class; *c != '\0'; c++) {
+		if (*c == '.') {
+			*c = '-';
+		}
+	}
+	return class;
+}
+
+/*
+ * Build the entry for each app that filtering and drawing work with, along
+ * with the columns that desktop_vec_score() scans. Entries point back into
+ * the vec, so this must be called once it's in its final order, and not
+ * added to or sorted afterwards.
+ */
+void desktop_vec_build_entries(struct desktop_vec *restrict vec)
+{
+	struct arena *arena = &vec->arena;
+	vec->entries = arena_alloc(arena, vec->count * sizeof(*vec->entries));
+	vec->name_signatures = arena_alloc(arena, vec->count * sizeof(*vec->name_signatures));
+	vec->keywords_signatures = arena_alloc(arena, vec->count * sizeof(*vec->keywords_signatures));
+	vec->history_scores = arena_alloc(arena, vec->count * sizeof(*vec->history_scores));
+
+	for (size_t i = 0; i < vec->count; i++) {
+		struct desktop_entry *des = &vec->buf[i];
+		struct entry *entry = &vec->entries[i];
+
+		/* Keep each app's strings next to the keys built from them. */
+		des->name = arena_move(arena, des->name);
+		des->keywords = arena_move(arena, des->keywords);
+
+		size_t name_length = strlen(des->name);
+		*entry = (struct entry) {
+			.key = {
+				.name_length = name_length,
+				.entry = entry
+			},
+			.icon = &des->icon,
+			.name = des->name,
+			.name_length = name_length,
+			.comment = des->comment,
+			.keywords = des->keywords,
+			.css_class = app_class(arena, des->id)
+		};
+		search_key_init_arena(&entry->key.name_key, entry->name, arena);
+		search_key_init_arena(&entry->keywords_key, entry->keywords, arena);
+
+		vec->name_signatures[i] = entry->key.name_key.signature;
+		vec->keywords_signatures[i] = entry->keywords_key.signature;
+		vec->history_scores[i] = des->history_score;
+		des->entry = entry;
+	}
 }
 
 struct desktop_entry *desktop_vec_add(
@@ -56,82 +150,115 @@ struct desktop_entry *desktop_vec_add(
 	vec->buf[vec->count].keywords = xstrdup(keywords);
 	vec->buf[vec->count].search_score = 0;
 	vec->buf[vec->count].history_score = 0;
+	vec->buf[vec->count].entry = NULL;
 	vec->count++;
 
   return &vec->buf[vec->count];
 }
 
-void desktop_vec_add_file(
-    struct desktop_vec *vec,
-    const char *id,
-    const char *path)
-{
-  log_debug("parse_desktop_file %s\n", path);
-	GKeyFile *file = g_key_file_new();
-  log_debug("have gkeyfile\n");
-	if (!g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, NULL)) {
+/*
+ * Read the parts of a .desktop file we care about into info. Returns false
+ * if the file couldn't be read, or has no name. For hidden apps, only hidden
+ * is filled in.
+ *
+ * This doesn't depend on the environment, so the result can be cached. Use
+ * desktop_info_visible() to decide whether to actually show the app.
+ */
+bool desktop_info_load(struct desktop_info *info, const char *path)
+{
+	*info = (struct desktop_info) { 0 };
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
 		log_error("Failed to open %s.\n", path);
-		return;
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		log_error("Failed to open %s.\n", path);
+		close(fd);
+		return false;
 	}
-  log_debug("loaded file\n");
-
-	const char *group = "Desktop Entry";
 
-	if (g_key_file_get_boolean(file, group, "Hidden", NULL)
-			|| g_key_file_get_boolean(file, group, "NoDisplay", NULL)) {
-		goto cleanup_file;
+	size_t size = st.st_size;
+	char *buf = xmalloc(size + 1);
+	size_t length = 0;
+	while (length < size) {
+		ssize_t res = read(fd, &buf[length], size - length);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			break;
+		}
+		length += res;
 	}
+	close(fd);
 
-  log_debug("loading name\n");
-	char *name = g_key_file_get_locale_string(file, group, "Name", NULL, NULL);
-	if (name == NULL) {
+	bool ok = desktop_file_parse(
+			info,
+			buf,
+			length,
+			(const char *const *)g_get_language_names());
+	free(buf);
+	if (!ok) {
 		log_error("%s: No name found.\n", path);
-		goto cleanup_file;
 	}
-  log_debug("parse_desktop_file %s\n", name);
+	return ok;
+}
 
-	char *icon = g_key_file_get_locale_string(file, group, "Icon", NULL, NULL);
+void desktop_info_destroy(struct desktop_info *info)
+{
+	free(info->name);
+	free(info->icon);
+	free(info->keywords);
+	free(info->only_show_in);
+	free(info->not_show_in);
+}
 
-	/*
-	 * This is really a list rather than a string, but for the purposes of
-	 * matching against user input it's easier to just keep it as a string.
-	 */
-	char *keywords = g_key_file_get_locale_string(file, group, "Keywords", NULL, NULL);
-	if (keywords == NULL) {
-		keywords = xmalloc(1);
-		*keywords = '\0';
-	}
-
-	gsize length;
-	gchar **list = g_key_file_get_string_list(file, group, "OnlyShowIn", &length, NULL);
-	if (list) {
-		bool match = match_current_desktop(list, length);
-		g_strfreev(list);
-		list = NULL;
-		if (!match) {
-			goto cleanup_all;
-		}
+/* Whether an app should be shown on the current desktop. */
+bool desktop_info_visible(const struct desktop_info *info)
+{
+	if (info->hidden) {
+		return false;
 	}
-
-	list = g_key_file_get_string_list(file, group, "NotShowIn", &length, NULL);
-	if (list) {
-		bool match = match_current_desktop(list, length);
-		g_strfreev(list);
-		list = NULL;
-		if (match) {
-			goto cleanup_all;
-		}
+	if (info->only_show_in != NULL && !match_current_desktop(info->only_show_in)) {
+		return false;
+	}
+	if (info->not_show_in != NULL && match_current_desktop(info->not_show_in)) {
+		return false;
 	}
+	return true;
+}
 
-	struct desktop_entry *d = desktop_vec_add(vec, id, name, icon, path,
-      keywords);
+void desktop_vec_add_info(
+		struct desktop_vec *vec,
+		const char *id,
+		const char *path,
+		const struct desktop_info *info)
+{
+	desktop_vec_add(
+			vec,
+			id,
+			info->name,
+			info->icon != NULL ? info->icon : "",
+			path,
+			info->keywords != NULL ? info->keywords : "");
+}
 
-cleanup_all:
-	free(keywords);
-	free(name);
-	free(icon);
-cleanup_file:
-	g_key_file_unref(file);
+void desktop_vec_add_file(
+		struct desktop_vec *vec,
+		const char *id,
+		const char *path)
+{
+	struct desktop_info info;
+	if (!desktop_info_load(&info, path)) {
+		return;
+	}
+	if (desktop_info_visible(&info)) {
+		desktop_vec_add_info(vec, id, path, &info);
+	}
+	desktop_info_destroy(&info);
 }
 
 static int cmpdesktopp(const void *restrict a, const void *restrict b)
@@ -141,16 +268,6 @@ static int cmpdesktopp(const void *restrict a, const void *restrict b)
 	return strcmp(d1->name, d2->name);
 }
 
-static int cmpresultscorep(const void *restrict a, const void *restrict b)
-{
-	struct scored_entry *restrict res1 = (struct scored_entry *)a;
-	struct scored_entry *restrict res2 = (struct scored_entry *)b;
-
-	int hist_diff = res2->history_score - res1->history_score;
-	int search_diff = res2->search_score - res1->search_score;
-	return hist_diff + search_diff;
-}
-
 void desktop_vec_sort(struct desktop_vec *restrict vec)
 {
 	qsort(vec->buf, vec->count, sizeof(vec->buf[0]), cmpdesktopp);
@@ -169,51 +286,71 @@ struct desktop_entry *desktop_vec_find_sorted(struct desktop_vec *restrict vec,
 struct entry_ref_vec desktop_vec_filter(
 		const struct desktop_vec *restrict vec,
 		const char *restrict substr,
-		bool fuzzy)
+		enum matching_algorithm matching_algorithm)
 {
 	struct entry_ref_vec filt = entry_ref_vec_create();
-	for (size_t i = 0; i < vec->count; i++) {
-		int32_t search_score;
-		if (fuzzy) {
-			search_score = fuzzy_match_words(substr, vec->buf[i].name);
-		} else {
-			search_score = fuzzy_match_simple_words(substr, vec->buf[i].name);
+	struct search_query query;
+	search_query_init(&query, substr, matching_algorithm);
+	desktop_vec_score(&filt, vec, 0, vec->count, &query);
+	search_query_destroy(&query);
+	/*
+	 * Sort the entrys by this search_score. This moves matches at the beginnings
+	 * of words to the front of the entry list.
+	 */
+	entry_ref_vec_score_sort(&filt);
+	return filt;
+}
+
+/*
+ * Match entries [start, end) of vec against query, and append any matches to
+ * filt, unsorted. The entries must have been built with
+ * desktop_vec_build_entries().
+ */
+void desktop_vec_score(
+		struct entry_ref_vec *restrict filt,
+		const struct desktop_vec *restrict vec,
+		size_t start,
+		size_t end,
+		const struct search_query *restrict query)
+{
+	for (size_t i = start; i < end; i++) {
+		if ((i - start) % SEARCH_QUERY_CANCEL_INTERVAL == 0
+				&& search_query_cancelled(query)) {
+			return;
 		}
-		if (search_score != INT32_MIN) {
-			entry_ref_vec_add_desktop(&filt, &vec->buf[i]);
-			/*
-			 * Store the position of the match in the string as
-			 * its search_score, for later sorting.
-			 */
-			filt.buf[filt.count - 1].search_score = search_score;
-			filt.buf[filt.count - 1].history_score = vec->buf[i].history_score;
-		} else {
+		int32_t search_score = INT32_MIN;
+		if (search_signature_covers(vec->name_signatures[i], query)) {
+			search_score = match_words(query, &vec->entries[i].key.name_key);
+		}
+		if (search_score == INT32_MIN
+				&& search_signature_covers(vec->keywords_signatures[i], query)) {
 			/* If we didn't match the name, check the keywords. */
-			if (fuzzy) {
-				search_score = fuzzy_match_words(substr, vec->buf[i].keywords);
-			} else {
-				search_score = fuzzy_match_simple_words(substr, vec->buf[i].keywords);
-			}
+			search_score = match_words(query, &vec->entries[i].keywords_key);
 			if (search_score != INT32_MIN) {
-				entry_ref_vec_add_desktop(&filt, &vec->buf[i]);
 				/*
 				 * Arbitrary score addition to make name
 				 * matches preferred over keyword matches.
 				 */
-				filt.buf[filt.count - 1].search_score = search_score - 20;
-				filt.buf[filt.count - 1].history_score = vec->buf[i].history_score;
+				search_score -= 20;
 			}
 		}
+		if (search_score != INT32_MIN) {
+			entry_ref_vec_add(filt, &vec->entries[i].key);
+			/*
+			 * Store the position of the match in the string as
+			 * its search_score, for later sorting.
+			 */
+			filt->buf[filt->count - 1].search_score = search_score;
+			filt->buf[filt->count - 1].history_score = vec->history_scores[i];
+		}
 	}
-	/*
-	 * Sort the entrys by this search_score. This moves matches at the beginnings
-	 * of words to the front of the entry list.
-	 */
-	qsort(filt.buf, filt.count, sizeof(filt.buf[0]), cmpresultscorep);
-	return filt;
 }
 
-bool match_current_desktop(char * const *desktop_list, gsize length)
+/*
+ * Whether any of the desktops in the semicolon-separated desktop_list are in
+ * $XDG_CURRENT_DESKTOP.
+ */
+bool match_current_desktop(const char *desktop_list)
 {
 	const char *xdg_current_desktop = getenv("XDG_CURRENT_DESKTOP");
 	if (xdg_current_desktop == NULL) {
@@ -224,20 +361,26 @@ bool match_current_desktop(char * const *desktop_list, gsize length)
 
 	char *saveptr = NULL;
 	char *tmp = xstrdup(xdg_current_desktop);
- 	char *desktop = strtok_r(tmp, ":", &saveptr);
- 	while (desktop != NULL) {
+	char *desktop = strtok_r(tmp, ":", &saveptr);
+	while (desktop != NULL) {
 		string_vec_add(&desktops, desktop);
- 		desktop = strtok_r(NULL, ":", &saveptr);
- 	}
-
+		desktop = strtok_r(NULL, ":", &saveptr);
+	}
 	string_vec_sort(&desktops);
-	for (gsize i = 0; i < length; i++) {
-		if (string_vec_find_sorted(&desktops, desktop_list[i])) {
-			return true;
+	free(tmp);
+
+	bool match = false;
+	tmp = xstrdup(desktop_list);
+	desktop = strtok_r(tmp, ";", &saveptr);
+	while (desktop != NULL) {
+		if (string_vec_find_sorted(&desktops, desktop)) {
+			match = true;
+			break;
 		}
- 	}
+		desktop = strtok_r(NULL, ";", &saveptr);
+	}
+	free(tmp);
 
 	string_vec_destroy(&desktops);
-	free(tmp);
-	return false;
+	return match;
 }
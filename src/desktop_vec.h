@@ -6,7 +6,9 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include "arena.h"
 #include "icon.h"
+#include "search_key.h"
 #include "entry.h"
 
 struct desktop_entry {
@@ -18,12 +20,44 @@ struct desktop_entry {
 	char *keywords;
 	uint32_t search_score;
 	uint32_t history_score;
+	/* Set by desktop_vec_build_entries(). */
+	struct entry *entry;
+};
+
+/*
+ * The parts of a .desktop file we care about, before deciding whether to show
+ * it. Any string may be NULL if the key was missing.
+ */
+struct desktop_info {
+	char *name;
+	char *icon;
+	char *keywords;
+	/* Raw, semicolon-separated lists of desktops. */
+	char *only_show_in;
+	char *not_show_in;
+	/* Hidden or NoDisplay. */
+	bool hidden;
 };
 
 struct desktop_vec {
 	size_t count;
 	size_t size;
 	struct desktop_entry *buf;
+
+	/*
+	 * What filtering needs from each app, built by
+	 * desktop_vec_build_entries(). Each is an array in the same order as
+	 * buf, so the filter loop streams through signatures and only
+	 * touches an app's entry (and its keys and strings, which are packed
+	 * in alongside) when the signatures say it might match.
+	 */
+	struct entry *entries;
+	uint64_t *name_signatures;
+	uint64_t *keywords_signatures;
+	int32_t *history_scores;
+
+	/* Holds all of the above, which last as long as the vec. */
+	struct arena arena;
 };
 
 [[nodiscard("memory leaked")]]
@@ -36,13 +70,30 @@ struct desktop_entry *desktop_vec_add(
     const char *restrict icon,
     const char *restrict path,
     const char *restrict keywords);
+void desktop_vec_add_info(
+    struct desktop_vec *vec,
+    const char *id,
+    const char *path,
+    const struct desktop_info *info);
 void desktop_vec_add_file(struct desktop_vec *desktop, const char *id, const char *path);
 
+bool desktop_info_load(struct desktop_info *info, const char *path);
+void desktop_info_destroy(struct desktop_info *info);
+bool desktop_info_visible(const struct desktop_info *info);
+
+void desktop_vec_build_entries(struct desktop_vec *restrict vec);
+
 void desktop_vec_sort(struct desktop_vec *restrict vec);
 struct desktop_entry *desktop_vec_find_sorted(struct desktop_vec *restrict vec, const char *name);
 struct entry_ref_vec desktop_vec_filter(
     const struct desktop_vec *restrict vec,
     const char *restrict substr,
-    bool fuzzy);
+    enum matching_algorithm matching_algorithm);
+void desktop_vec_score(
+    struct entry_ref_vec *restrict filt,
+    const struct desktop_vec *restrict vec,
+    size_t start,
+    size_t end,
+    const struct search_query *restrict query);
 
 #endif /* DESKTOP_VEC_H */
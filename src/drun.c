@@ -1,7 +1,6 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
-#include <fts.h>
 #include <glib.h>
 #include <gio/gdesktopappinfo.h>
 #include <stdbool.h>
@@ -10,10 +9,12 @@
 #include <string.h>
 #include <sys/stat.h>
 #include "drun.h"
+#include "drun_cache.h"
 #include "history.h"
 #include "log.h"
 #include "mkdirp.h"
 #include "string_vec.h"
+#include "thread_pool.h"
 #include "xmalloc.h"
 
 static const char *default_data_dir = ".local/share/";
@@ -111,95 +112,427 @@ static struct string_vec get_application_paths() {
 	return paths;
 }
 
-static void parse_desktop_file(gpointer key, gpointer value, void *data)
+/* The languages GKeyFile uses to localise names, as one string. */
+[[nodiscard("memory leaked")]]
+static char *get_languages(void)
 {
-	const char *id = key;
-	const char *path = value;
-	struct desktop_vec *apps = data;
+	return g_strjoinv(":", (gchar **)g_get_language_names());
+}
+
+/* How deep to follow nested application dirs, in case of symlink loops. */
+#define MAX_SCAN_DEPTH 16
+
+/* How many files each parsing task handles. */
+#define PARSE_CHUNK_SIZE 16
+
+/*
+ * Some of the old cache's files or dirs, grouped by the dir they're in. The
+ * indices of those in dir d are order[start[d]] up to order[start[d + 1]],
+ * in their original order.
+ */
+struct dir_index {
+	uint32_t *start;
+	uint32_t *order;
+};
+
+/* State for a scan of the application dirs. */
+struct scan {
+	struct drun_cache *cache;
 
-	desktop_vec_add_file(apps, id, path);
+	/* What we found last time, if anything, by path and by dir. */
+	const struct drun_cache *old;
+	GHashTable *old_dirs;
+	GHashTable *old_files;
+	struct dir_index old_files_by_dir;
+	struct dir_index old_subdirs_by_dir;
+
+	/* Dirs that must be read again regardless, or NULL. */
+	GHashTable *changed;
+
+	/* Indices of the files in cache that still need parsing. */
+	size_t num_pending;
+	size_t pending_size;
+	size_t *pending;
+};
+
+/* The files parse_chunk() works on, and where it puts the results. */
+struct parse_job {
+	const struct drun_cache *cache;
+	const size_t *pending;
+	size_t num_pending;
+	struct desktop_info *infos;
+	bool *valid;
+};
+
+/*
+ * Group count items by the dir each is in, given by dirs (DRUN_CACHE_NONE
+ * for none), with a counting sort.
+ */
+static struct dir_index index_by_dir(const uint32_t *dirs, size_t count, size_t num_dirs)
+{
+	struct dir_index index = {
+		.start = xcalloc(num_dirs + 1, sizeof(*index.start)),
+		.order = xcalloc(count + 1, sizeof(*index.order))
+	};
+	for (size_t i = 0; i < count; i++) {
+		if (dirs[i] != DRUN_CACHE_NONE) {
+			index.start[dirs[i] + 1]++;
+		}
+	}
+	for (size_t d = 0; d < num_dirs; d++) {
+		index.start[d + 1] += index.start[d];
+	}
+	uint32_t *next = xcalloc(num_dirs + 1, sizeof(*next));
+	memcpy(next, index.start, (num_dirs + 1) * sizeof(*next));
+	for (size_t i = 0; i < count; i++) {
+		if (dirs[i] != DRUN_CACHE_NONE) {
+			index.order[next[dirs[i]]++] = i;
+		}
+	}
+	free(next);
+	return index;
 }
 
-struct desktop_vec drun_generate(void)
+static void dir_index_destroy(struct dir_index *index)
 {
-	/*
-	 * Note for the future: this custom logic could be replaced with
-	 * g_app_info_get_all(), but that's slower. Worth remembering
-	 * though if this runs into issues.
-	 */
-	log_debug("Retrieving application dirs.\n");
-	struct string_vec paths = get_application_paths();
- 	struct string_vec desktop_files = string_vec_create();
- 	log_debug("Scanning for .desktop files.\n");
- 	for (size_t i = 0; i < paths.count; i++) {
-		const char *path_entry = paths.buf[i].string;
- 		DIR *dir = opendir(path_entry);
- 		if (dir != NULL) {
- 			struct dirent *d;
- 			while ((d = readdir(dir)) != NULL) {
-				const char *extension = strrchr(d->d_name, '.');
-				if (extension == NULL) {
-					continue;
-				}
-				if (strcmp(extension, ".desktop")) {
-					continue;
-				}
- 				string_vec_add(&desktop_files, d->d_name);
- 			}
- 			closedir(dir);
- 		}
- 	}
-	log_debug("Found %zu files.\n", desktop_files.count);
+	free(index->start);
+	free(index->order);
+}
 
+static bool same_mtime(int64_t sec, int64_t nsec, const struct stat *st)
+{
+	return st->st_mtim.tv_sec == sec && st->st_mtim.tv_nsec == nsec;
+}
 
- 	log_debug("Parsing .desktop files.\n");
-	/*
-	 * The Desktop Entry Specification says that only the highest
-	 * precedence application file with a given ID should be used, so store
-	 * the id / path pairs into a hash table to enforce uniqueness.
-	 */
-	GHashTable *id_hash = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
-	struct desktop_vec apps = desktop_vec_create();
- 	for (size_t i = 0; i < paths.count; i++) {
-		char *path_entry = paths.buf[i].string;
-		char *tree[2] = { path_entry, NULL };
-		size_t prefix_len = strlen(path_entry);
-		FTS *fts = fts_open(tree, FTS_LOGICAL, NULL);
-		FTSENT *entry = fts_read(fts);
-		for (; entry != NULL; entry = fts_read(fts)) {
-			const char *extension = strrchr(entry->fts_name, '.');
-			if (extension == NULL) {
-				continue;
-			}
-			if (strcmp(extension, ".desktop")) {
-				continue;
-			}
-			char *id = xstrdup(&entry->fts_path[prefix_len]);
-			char *slash = strchr(id, '/');
-			while (slash != NULL) {
-				*slash = '-';
-				slash = strchr(slash, '/');
-			}
-			/*
-			 * We're iterating from highest to lowest precedence,
-			 * so only the first file with a given ID should be
-			 * stored.
-			 */
-			if (!g_hash_table_contains(id_hash, id)) {
-				char *path = xstrdup(entry->fts_path);
-				g_hash_table_insert(id_hash, id, path);
-			} else {
-				free(id);
+[[nodiscard("memory leaked")]]
+static char *join_path(const char *dir, const char *name)
+{
+	size_t dir_len = strlen(dir);
+	const char *sep = (dir_len > 0 && dir[dir_len - 1] == '/') ? "" : "/";
+	size_t len = dir_len + strlen(sep) + strlen(name) + 1;
+	char *path = xmalloc(len);
+	snprintf(path, len, "%s%s%s", dir, sep, name);
+	return path;
+}
+
+/*
+ * The desktop file ID is the path relative to the application dir, with
+ * slashes replaced by dashes.
+ */
+[[nodiscard("memory leaked")]]
+static char *desktop_file_id(const char *path, size_t prefix_len)
+{
+	char *id = xstrdup(&path[prefix_len]);
+	char *slash = strchr(id, '/');
+	while (slash != NULL) {
+		*slash = '-';
+		slash = strchr(slash, '/');
+	}
+	return id;
+}
+
+/*
+ * Add the .desktop file at path to the cache, marking it for parsing if it's
+ * new or has changed since the last scan.
+ */
+static void scan_file(
+		struct scan *scan,
+		const char *path,
+		const struct stat *st,
+		size_t prefix_len,
+		uint32_t dir)
+{
+	struct drun_cache_file file = {
+		.id = desktop_file_id(path, prefix_len),
+		.path = (char *)path,
+		.dir = dir,
+		.mtime_sec = st->st_mtim.tv_sec,
+		.mtime_nsec = st->st_mtim.tv_nsec,
+		.size = st->st_size,
+		.inode = st->st_ino,
+		.valid = false,
+		.shadowed = false,
+		.info = { 0 }
+	};
+
+	const struct drun_cache_file *old = NULL;
+	if (scan->old_files != NULL) {
+		old = g_hash_table_lookup(scan->old_files, path);
+	}
+	if (old != NULL
+			&& same_mtime(old->mtime_sec, old->mtime_nsec, st)
+			&& old->size == st->st_size
+			&& old->inode == st->st_ino) {
+		file.valid = old->valid;
+		file.info = old->info;
+	} else {
+		/* Leave this for parse_files(), once we've found them all. */
+		if (scan->num_pending == scan->pending_size) {
+			scan->pending_size = scan->pending_size == 0 ? 64 : scan->pending_size * 2;
+			scan->pending = xrealloc(scan->pending, scan->pending_size * sizeof(scan->pending[0]));
+		}
+		scan->pending[scan->num_pending++] = scan->cache->num_files;
+	}
+	drun_cache_add_file(scan->cache, &file);
+	free(file.id);
+}
+
+static void parse_chunk(void *arg, size_t index)
+{
+	struct parse_job *job = arg;
+	size_t start = index * PARSE_CHUNK_SIZE;
+	size_t end = start + PARSE_CHUNK_SIZE;
+	if (end > job->num_pending) {
+		end = job->num_pending;
+	}
+	for (size_t i = start; i < end; i++) {
+		const char *path = job->cache->files[job->pending[i]].path;
+		job->valid[i] = desktop_info_load(&job->infos[i], path);
+	}
+}
+
+/*
+ * Parse every file the scan found to be new or changed. Parsing is mostly
+ * independent per-file work, so when there's a lot of it (e.g. on a first run
+ * with flatpak or snap exports), spread it across a thread pool.
+ */
+static void parse_files(struct scan *scan)
+{
+	struct parse_job job = {
+		.cache = scan->cache,
+		.pending = scan->pending,
+		.num_pending = scan->num_pending,
+		.infos = xcalloc(scan->num_pending + 1, sizeof(*job.infos)),
+		.valid = xcalloc(scan->num_pending + 1, sizeof(*job.valid))
+	};
+	size_t num_chunks = (job.num_pending + PARSE_CHUNK_SIZE - 1) / PARSE_CHUNK_SIZE;
+
+	size_t num_threads = thread_pool_default_size();
+	if (num_threads > num_chunks - 1) {
+		num_threads = num_chunks - 1;
+	}
+	if (num_chunks > 1 && num_threads > 0) {
+		struct thread_pool *pool = thread_pool_create(num_threads);
+		thread_pool_run(pool, parse_chunk, &job, num_chunks);
+		thread_pool_destroy(pool);
+	} else {
+		for (size_t i = 0; i < num_chunks; i++) {
+			parse_chunk(&job, i);
+		}
+	}
+
+	/* The cache's arena isn't thread-safe, so copy results in here. */
+	for (size_t i = 0; i < job.num_pending; i++) {
+		drun_cache_set_info(scan->cache, job.pending[i], job.valid[i], &job.infos[i]);
+		desktop_info_destroy(&job.infos[i]);
+	}
+	log_debug("Parsed %zu .desktop files.\n", job.num_pending);
+	free(job.infos);
+	free(job.valid);
+}
+
+static void scan_dir(
+		struct scan *scan,
+		const char *path,
+		const struct stat *st,
+		size_t prefix_len,
+		uint32_t root,
+		uint32_t parent,
+		int depth);
+
+/* Scan the subdirectory at path, if it still is one. */
+static void scan_subdir(
+		struct scan *scan,
+		const char *path,
+		size_t prefix_len,
+		uint32_t root,
+		uint32_t parent,
+		int depth)
+{
+	struct stat st;
+	if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode)) {
+		return;
+	}
+	if (depth >= MAX_SCAN_DEPTH) {
+		log_debug("Not descending into %s, too deep.\n", path);
+		return;
+	}
+	scan_dir(scan, path, &st, prefix_len, root, parent, depth + 1);
+}
+
+/*
+ * Record the dir at path and everything under it in the cache.
+ *
+ * If the old cache has the dir with the same mtime, its list of files and
+ * subdirectories can't have changed, so we can skip reading it and just look
+ * at the subdirectories it had. Otherwise, read it again, reusing whatever
+ * we can for files that haven't changed.
+ */
+static void scan_dir(
+		struct scan *scan,
+		const char *path,
+		const struct stat *st,
+		size_t prefix_len,
+		uint32_t root,
+		uint32_t parent,
+		int depth)
+{
+	uint32_t index = drun_cache_add_dir(scan->cache, path, st, root, parent);
+
+	const struct drun_cache_dir *old = NULL;
+	if (scan->old_dirs != NULL) {
+		old = g_hash_table_lookup(scan->old_dirs, path);
+	}
+	bool changed = scan->changed != NULL && g_hash_table_contains(scan->changed, path);
+	if (old != NULL && !changed && same_mtime(old->mtime_sec, old->mtime_nsec, st)) {
+		const struct drun_cache *cache = scan->old;
+		uint32_t old_index = old - cache->dirs;
+		const struct dir_index *files = &scan->old_files_by_dir;
+		for (uint32_t i = files->start[old_index]; i < files->start[old_index + 1]; i++) {
+			const struct drun_cache_file *file = &cache->files[files->order[i]];
+			struct drun_cache_file copy = *file;
+			copy.id = desktop_file_id(file->path, prefix_len);
+			copy.dir = index;
+			drun_cache_add_file(scan->cache, &copy);
+			free(copy.id);
+		}
+		const struct dir_index *subdirs = &scan->old_subdirs_by_dir;
+		for (uint32_t i = subdirs->start[old_index]; i < subdirs->start[old_index + 1]; i++) {
+			const char *subdir = cache->dirs[subdirs->order[i]].path;
+			scan_subdir(scan, subdir, prefix_len, root, index, depth);
+		}
+		return;
+	}
+
+	log_debug("Scanning %s.\n", path);
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		return;
+	}
+	struct string_vec subdirs = string_vec_create();
+	struct dirent *d;
+	while ((d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.') {
+			continue;
+		}
+		const char *extension = strrchr(d->d_name, '.');
+		bool desktop_file = extension != NULL && strcmp(extension, ".desktop") == 0;
+		if (!desktop_file && d->d_type != DT_DIR && d->d_type != DT_LNK && d->d_type != DT_UNKNOWN) {
+			continue;
+		}
+		char *child = join_path(path, d->d_name);
+		struct stat child_st;
+		if (stat(child, &child_st) == 0) {
+			if (S_ISDIR(child_st.st_mode)) {
+				string_vec_add(&subdirs, child);
+			} else if (desktop_file && S_ISREG(child_st.st_mode)) {
+				scan_file(scan, child, &child_st, prefix_len, index);
 			}
+		}
+		free(child);
+	}
+	closedir(dir);
 
+	/* Files in a dir take precedence over those in its subdirs. */
+	for (size_t i = 0; i < subdirs.count; i++) {
+		scan_subdir(scan, subdirs.buf[i].string, prefix_len, root, index, depth);
+	}
+	string_vec_destroy(&subdirs);
+}
+
+/*
+ * Find and parse every .desktop file in paths into cache, recording each
+ * directory we look in along the way. If old isn't NULL, only directories
+ * that have changed since it was made, or are in changed, are read, and only
+ * files that have changed are parsed.
+ */
+static void scan_applications(
+		struct drun_cache *cache,
+		const struct drun_cache *old,
+		const struct string_vec *paths,
+		const struct string_vec *changed)
+{
+	struct scan scan = {
+		.cache = cache,
+		.old = old,
+		.old_dirs = NULL,
+		.old_files = NULL,
+		.old_files_by_dir = { 0 },
+		.old_subdirs_by_dir = { 0 },
+		.changed = NULL,
+		.num_pending = 0,
+		.pending_size = 0,
+		.pending = NULL
+	};
+	if (old != NULL) {
+		scan.old_dirs = g_hash_table_new(g_str_hash, g_str_equal);
+		for (size_t i = 0; i < old->num_dirs; i++) {
+			g_hash_table_insert(scan.old_dirs, old->dirs[i].path, &old->dirs[i]);
+		}
+		scan.old_files = g_hash_table_new(g_str_hash, g_str_equal);
+		for (size_t i = 0; i < old->num_files; i++) {
+			g_hash_table_insert(scan.old_files, old->files[i].path, &old->files[i]);
 		}
-		fts_close(fts);
- 	}
 
-	/* Parse the remaining files into our desktop_vec. */
-	g_hash_table_foreach(id_hash, parse_desktop_file, &apps);
-	g_hash_table_unref(id_hash);
+		size_t num_keys = MAX(old->num_files, old->num_dirs);
+		uint32_t *keys = xcalloc(num_keys + 1, sizeof(*keys));
+		for (size_t i = 0; i < old->num_files; i++) {
+			keys[i] = old->files[i].dir;
+		}
+		scan.old_files_by_dir = index_by_dir(keys, old->num_files, old->num_dirs);
+		for (size_t i = 0; i < old->num_dirs; i++) {
+			keys[i] = old->dirs[i].parent;
+		}
+		scan.old_subdirs_by_dir = index_by_dir(keys, old->num_dirs, old->num_dirs);
+		free(keys);
+	}
+	if (changed != NULL && changed->count > 0) {
+		scan.changed = g_hash_table_new(g_str_hash, g_str_equal);
+		for (size_t i = 0; i < changed->count; i++) {
+			g_hash_table_add(scan.changed, changed->buf[i].string);
+		}
+	}
 
+ 	log_debug("Scanning for .desktop files.\n");
+	for (size_t i = 0; i < paths->count; i++) {
+		const char *path = paths->buf[i].string;
+		struct stat st;
+		if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+			scan_dir(&scan, path, &st, strlen(path), i, DRUN_CACHE_NONE, 0);
+		} else {
+			drun_cache_add_dir(cache, path, NULL, i, DRUN_CACHE_NONE);
+		}
+	}
+	parse_files(&scan);
+	free(scan.pending);
+
+	/*
+	 * We've visited dirs from highest to lowest precedence, so now we
+	 * can work out which file wins for each ID.
+	 */
+	drun_cache_resolve_ids(cache);
+
+	if (old != NULL) {
+		g_hash_table_unref(scan.old_dirs);
+		g_hash_table_unref(scan.old_files);
+		dir_index_destroy(&scan.old_files_by_dir);
+		dir_index_destroy(&scan.old_subdirs_by_dir);
+	}
+	if (scan.changed != NULL) {
+		g_hash_table_unref(scan.changed);
+	}
+}
+
+/* Pick out the apps in cache that should be shown on this desktop. */
+static struct desktop_vec apps_from_cache(const struct drun_cache *cache)
+{
+	struct desktop_vec apps = desktop_vec_create();
+	for (size_t i = 0; i < cache->num_files; i++) {
+		const struct drun_cache_file *file = &cache->files[i];
+		if (file->valid && !file->shadowed && desktop_info_visible(&file->info)) {
+			desktop_vec_add_info(&apps, file->id, file->path, &file->info);
+		}
+	}
 	log_debug("Found %zu apps.\n", apps.count);
 
 	/*
@@ -208,13 +541,112 @@ struct desktop_vec drun_generate(void)
 	 */
 	log_debug("Sorting results.\n");
 	desktop_vec_sort(&apps);
+	return apps;
+}
+
+struct desktop_vec drun_generate(void)
+{
+	/*
+	 * Note for the future: this custom logic could be replaced with
+	 * g_app_info_get_all(), but that's slower. Worth remembering
+	 * though if this runs into issues.
+	 */
+	log_debug("Retrieving application dirs.\n");
+	struct string_vec paths = get_application_paths();
+	char *languages = get_languages();
 
-	string_vec_destroy(&desktop_files);
+	struct drun_cache cache;
+	drun_cache_init(&cache, languages);
+	scan_applications(&cache, NULL, &paths, NULL);
+	struct desktop_vec apps = apps_from_cache(&cache);
+
+	drun_cache_destroy(&cache);
+	g_free(languages);
 	string_vec_destroy(&paths);
 	return apps;
 }
 
-void drun_print(const char *filename, const char *terminal_command)
+/*
+ * Like drun_generate(), but use the cache in $XDG_CACHE_HOME/tofi-drun if
+ * nothing's changed since it was written. If anything has, only rescan the
+ * dirs and reparse the files that changed, and write a new cache.
+ */
+struct desktop_vec drun_generate_cached(void)
+{
+	return drun_refresh(NULL);
+}
+
+/*
+ * Like drun_generate_cached(), but also rescan the dirs in changed (which may
+ * be NULL), even if their mtimes say otherwise. Editing a file in place
+ * doesn't touch its directory, so this is for when we know better, e.g. from
+ * inotify.
+ */
+struct desktop_vec drun_refresh(const struct string_vec *changed)
+{
+	char *cache_path = get_cache_path();
+	if (cache_path == NULL) {
+		return drun_generate();
+	}
+
+	log_debug("Retrieving application dirs.\n");
+	struct string_vec paths = get_application_paths();
+	char *languages = get_languages();
+
+	struct drun_cache cache;
+	struct drun_cache old;
+	bool have_old = drun_cache_load(&old, cache_path);
+	bool forced = changed != NULL && changed->count > 0;
+	if (have_old && !forced && drun_cache_valid(&old, &paths, languages)) {
+		cache = old;
+	} else {
+		/*
+		 * Names and keywords depend on the languages, so if those
+		 * have changed we have to start from scratch.
+		 */
+		if (have_old && strcmp(old.languages, languages) != 0) {
+			drun_cache_destroy(&old);
+			have_old = false;
+		}
+		drun_cache_init(&cache, languages);
+		scan_applications(&cache, have_old ? &old : NULL, &paths, changed);
+		drun_cache_save(&cache, cache_path);
+		if (have_old) {
+			drun_cache_destroy(&old);
+		}
+	}
+	struct desktop_vec apps = apps_from_cache(&cache);
+
+	drun_cache_destroy(&cache);
+	g_free(languages);
+	string_vec_destroy(&paths);
+	free(cache_path);
+	return apps;
+}
+
+/*
+ * Every dir that drun_generate_cached() looks in, as recorded in the cache,
+ * including application dirs that don't exist (yet).
+ */
+struct string_vec drun_app_dirs(void)
+{
+	struct string_vec dirs = string_vec_create();
+	char *cache_path = get_cache_path();
+	struct drun_cache cache;
+	if (cache_path != NULL && drun_cache_load(&cache, cache_path)) {
+		for (size_t i = 0; i < cache.num_dirs; i++) {
+			string_vec_add(&dirs, cache.dirs[i].path);
+		}
+		drun_cache_destroy(&cache);
+	} else {
+		string_vec_destroy(&dirs);
+		dirs = get_application_paths();
+	}
+	free(cache_path);
+	return dirs;
+}
+
+void drun_print(const char *filename, const char *terminal_command, FILE *out)
 {
 	GKeyFile *file = g_key_file_new();
 	if (!g_key_file_load_from_file(file, filename, G_KEY_FILE_NONE, NULL)) {
@@ -273,16 +705,16 @@ void drun_print(const char *filename, const char *terminal_command)
 			log_warning("This probably isn't what you want.\n");
 			log_warning("See the --terminal option documentation in the man page.\n");
 		} else {
-			fputs(terminal_command, stdout);
-			fputc(' ', stdout);
+			fputs(terminal_command, out);
+			fputc(' ', out);
 		}
 	}
 
         /* Build the command line from our vector. */
         for (size_t i = 0; i < pieces.count; i++) {
-		fputs(pieces.buf[i].string, stdout);
+		fputs(pieces.buf[i].string, out);
 	}
-	fputc('\n', stdout);
+	fputc('\n', out);
 
 	string_vec_destroy(&pieces);
 	free(exec);
@@ -329,3 +761,30 @@ void drun_history_sort(struct desktop_vec *apps, struct history *history)
 	}
 	qsort(apps->buf, apps->count, sizeof(apps->buf[0]), cmpscorep);
 }
+
+/*
+ * Set each app's history score again, e.g. after history_add(). Unlike
+ * drun_history_sort(), this doesn't need apps to be in alphabetical order,
+ * and leaves them where they are, so their entries stay valid.
+ */
+void drun_history_update(struct desktop_vec *apps, struct history *history)
+{
+	GHashTable *hash = g_hash_table_new(g_str_hash, g_str_equal);
+	for (size_t i = 0; i < apps->count; i++) {
+		apps->buf[i].history_score = 0;
+		g_hash_table_insert(hash, apps->buf[i].name, &apps->buf[i]);
+	}
+	for (size_t i = 0; i < history->count; i++) {
+		struct desktop_entry *res = g_hash_table_lookup(hash, history->buf[i].name);
+		if (res != NULL) {
+			res->history_score = history->buf[i].run_count;
+		}
+	}
+	g_hash_table_unref(hash);
+
+	if (apps->history_scores != NULL) {
+		for (size_t i = 0; i < apps->count; i++) {
+			apps->history_scores[i] = apps->buf[i].history_score;
+		}
+	}
+}
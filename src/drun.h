@@ -1,14 +1,19 @@
 #ifndef DRUN_H
 #define DRUN_H
 
+#include <stdio.h>
 #include "desktop_vec.h"
 #include "history.h"
 #include "string_vec.h"
 
 struct desktop_vec drun_generate(void);
 struct desktop_vec drun_generate_cached(void);
+struct desktop_vec drun_refresh(const struct string_vec *changed);
+[[nodiscard("memory leaked")]]
+struct string_vec drun_app_dirs(void);
 void drun_history_sort(struct desktop_vec *apps, struct history *history);
-void drun_print(const char *filename, const char *terminal_command);
+void drun_history_update(struct desktop_vec *apps, struct history *history);
+void drun_print(const char *filename, const char *terminal_command, FILE *out);
 void drun_launch(const char *filename);
 
 #endif /* DRUN_H */
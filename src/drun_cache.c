@@ -0,0 +1,363 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arena.h"
+#include "cache_file.h"
+#include "desktop_vec.h"
+#include "drun_cache.h"
+#include "log.h"
+#include "string_vec.h"
+#include "xmalloc.h"
+
+/*
+ * The cache file is a header followed by the directories and then the files,
+ * all packed together with no padding, in the format described in
+ * cache_file.h.
+ *
+ * Bump DRUN_CACHE_VERSION whenever any of this changes.
+ */
+#define DRUN_CACHE_MAGIC "tofidrun"
+#define DRUN_CACHE_MAGIC_LENGTH 8
+#define DRUN_CACHE_VERSION 2
+
+#define FILE_VALID (1 << 0)
+#define FILE_HIDDEN (1 << 1)
+#define FILE_SHADOWED (1 << 2)
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/* Returns a string pointing into the mapped file. */
+static char *get_str(struct cache_reader *reader)
+{
+	/* The mapping is read-only, but nothing writes to these strings. */
+	return (char *)cache_get_str(reader);
+}
+
+static char *cache_strdup(struct drun_cache *cache, const char *str)
+{
+	if (str == NULL) {
+		return NULL;
+	}
+	return arena_strndup(&cache->arena, str, strlen(str));
+}
+
+void drun_cache_init(struct drun_cache *cache, const char *languages)
+{
+	*cache = (struct drun_cache) {
+		.num_roots = 0,
+		.num_dirs = 0,
+		.dirs_size = 16,
+		.dirs = xcalloc(16, sizeof(*cache->dirs)),
+		.num_files = 0,
+		.files_size = 128,
+		.files = xcalloc(128, sizeof(*cache->files)),
+		.map = NULL,
+		.map_size = 0,
+	};
+	arena_init(&cache->arena, ARENA_BLOCK_SIZE);
+	cache->languages = cache_strdup(cache, languages);
+}
+
+void drun_cache_destroy(struct drun_cache *cache)
+{
+	free(cache->dirs);
+	free(cache->files);
+	arena_destroy(&cache->arena);
+	if (cache->map != NULL) {
+		munmap(cache->map, cache->map_size);
+	}
+}
+
+/*
+ * Record a directory and its modification time, or that it doesn't exist if
+ * st is NULL. Returns the index of the new record.
+ */
+uint32_t drun_cache_add_dir(
+		struct drun_cache *cache,
+		const char *path,
+		const struct stat *st,
+		uint32_t root,
+		uint32_t parent)
+{
+	if (cache->num_dirs == cache->dirs_size) {
+		cache->dirs_size *= 2;
+		cache->dirs = xrealloc(cache->dirs, cache->dirs_size * sizeof(cache->dirs[0]));
+	}
+	cache->dirs[cache->num_dirs] = (struct drun_cache_dir) {
+		.path = cache_strdup(cache, path),
+		.mtime_sec = st == NULL ? -1 : st->st_mtim.tv_sec,
+		.mtime_nsec = st == NULL ? 0 : st->st_mtim.tv_nsec,
+		.root = root,
+		.parent = parent
+	};
+	if (parent == DRUN_CACHE_NONE) {
+		cache->num_roots++;
+	}
+	return cache->num_dirs++;
+}
+
+/* Add a copy of file, strings and all. */
+void drun_cache_add_file(struct drun_cache *cache, const struct drun_cache_file *file)
+{
+	if (cache->num_files == cache->files_size) {
+		cache->files_size *= 2;
+		cache->files = xrealloc(cache->files, cache->files_size * sizeof(cache->files[0]));
+	}
+	struct drun_cache_file *copy = &cache->files[cache->num_files];
+	*copy = *file;
+	copy->id = cache_strdup(cache, file->id);
+	copy->path = cache_strdup(cache, file->path);
+	drun_cache_set_info(cache, cache->num_files, file->valid, &file->info);
+	cache->num_files++;
+}
+
+/* Fill in a copy of what we parsed from the file at index. */
+void drun_cache_set_info(
+		struct drun_cache *cache,
+		size_t index,
+		bool valid,
+		const struct desktop_info *info)
+{
+	struct drun_cache_file *file = &cache->files[index];
+	file->valid = valid;
+	file->info = (struct desktop_info) {
+		.name = cache_strdup(cache, info->name),
+		.icon = cache_strdup(cache, info->icon),
+		.keywords = cache_strdup(cache, info->keywords),
+		.only_show_in = cache_strdup(cache, info->only_show_in),
+		.not_show_in = cache_strdup(cache, info->not_show_in),
+		.hidden = info->hidden
+	};
+}
+
+/*
+ * The Desktop Entry Specification says that only the highest precedence
+ * application file with a given ID should be used. Files are added from
+ * highest to lowest precedence, so mark every file whose ID we've already
+ * seen as shadowed.
+ */
+void drun_cache_resolve_ids(struct drun_cache *cache)
+{
+	GHashTable *ids = g_hash_table_new(g_str_hash, g_str_equal);
+	for (size_t i = 0; i < cache->num_files; i++) {
+		struct drun_cache_file *file = &cache->files[i];
+		file->shadowed = g_hash_table_contains(ids, file->id);
+		if (!file->shadowed) {
+			g_hash_table_add(ids, file->id);
+		}
+	}
+	log_debug("Found %u files.\n", g_hash_table_size(ids));
+	g_hash_table_unref(ids);
+}
+
+/*
+ * Map the cache file and read its contents into cache, which shouldn't have
+ * been initialised. Returns false if there's no usable cache file.
+ */
+bool drun_cache_load(struct drun_cache *cache, const char *filename)
+{
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		log_debug("No drun cache found.\n");
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_error("Failed to map drun cache: %s.\n", strerror(errno));
+		return false;
+	}
+
+	struct cache_reader reader = cache_reader_create(map, st.st_size);
+	const char *magic = cache_get(&reader, DRUN_CACHE_MAGIC_LENGTH);
+	if (magic == NULL
+			|| memcmp(magic, DRUN_CACHE_MAGIC, DRUN_CACHE_MAGIC_LENGTH) != 0
+			|| cache_get_u32(&reader) != DRUN_CACHE_VERSION) {
+		log_debug("Ignoring drun cache from a different version.\n");
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	size_t num_dirs = cache_get_u32(&reader);
+	size_t num_files = cache_get_u32(&reader);
+
+	/* Don't trust the counts until we've seen that much data. */
+	if (!reader.ok
+			|| num_dirs > (size_t)st.st_size
+			|| num_files > (size_t)st.st_size) {
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	*cache = (struct drun_cache) {
+		.num_roots = 0,
+		.num_dirs = num_dirs,
+		.dirs_size = num_dirs,
+		.dirs = xcalloc(num_dirs + 1, sizeof(*cache->dirs)),
+		.num_files = num_files,
+		.files_size = num_files,
+		.files = xcalloc(num_files + 1, sizeof(*cache->files)),
+		.map = map,
+		.map_size = st.st_size
+	};
+	arena_init(&cache->arena, ARENA_BLOCK_SIZE);
+
+	cache->languages = get_str(&reader);
+	for (size_t i = 0; i < num_dirs; i++) {
+		struct drun_cache_dir *dir = &cache->dirs[i];
+		dir->mtime_sec = cache_get_i64(&reader);
+		dir->mtime_nsec = cache_get_i64(&reader);
+		dir->root = cache_get_u32(&reader);
+		dir->parent = cache_get_u32(&reader);
+		dir->path = get_str(&reader);
+		if (dir->parent == DRUN_CACHE_NONE) {
+			if (dir->root != cache->num_roots) {
+				reader.ok = false;
+			}
+			cache->num_roots++;
+		} else if (dir->parent >= i || dir->root != cache->dirs[dir->parent].root) {
+			reader.ok = false;
+		}
+		if (dir->path == NULL) {
+			reader.ok = false;
+		}
+	}
+	for (size_t i = 0; i < num_files; i++) {
+		struct drun_cache_file *file = &cache->files[i];
+		file->dir = cache_get_u32(&reader);
+		uint32_t flags = cache_get_u32(&reader);
+		file->valid = flags & FILE_VALID;
+		file->info.hidden = flags & FILE_HIDDEN;
+		file->shadowed = flags & FILE_SHADOWED;
+		file->mtime_sec = cache_get_i64(&reader);
+		file->mtime_nsec = cache_get_i64(&reader);
+		file->size = cache_get_i64(&reader);
+		file->inode = cache_get_i64(&reader);
+		file->id = get_str(&reader);
+		file->path = get_str(&reader);
+		file->info.name = get_str(&reader);
+		file->info.icon = get_str(&reader);
+		file->info.keywords = get_str(&reader);
+		file->info.only_show_in = get_str(&reader);
+		file->info.not_show_in = get_str(&reader);
+		if (file->id == NULL || file->path == NULL || file->dir >= num_dirs) {
+			reader.ok = false;
+		}
+		if (file->valid && !file->info.hidden && file->info.name == NULL) {
+			reader.ok = false;
+		}
+	}
+
+	if (!reader.ok || cache->languages == NULL) {
+		log_error("Drun cache is corrupt, ignoring it.\n");
+		drun_cache_destroy(cache);
+		return false;
+	}
+	log_debug("Loaded %zu files from drun cache.\n", cache->num_files);
+	return true;
+}
+
+static bool dir_unchanged(const struct drun_cache_dir *dir)
+{
+	struct stat st;
+	if (stat(dir->path, &st) == -1) {
+		return dir->mtime_sec == -1;
+	}
+	return st.st_mtim.tv_sec == dir->mtime_sec
+		&& st.st_mtim.tv_nsec == dir->mtime_nsec;
+}
+
+/*
+ * Check whether cache still describes what's on disk, given the application
+ * dirs we'd search and the current languages.
+ */
+bool drun_cache_valid(
+		const struct drun_cache *cache,
+		const struct string_vec *roots,
+		const char *languages)
+{
+	if (strcmp(cache->languages, languages) != 0) {
+		log_debug("Languages changed, drun cache is stale.\n");
+		return false;
+	}
+	if (cache->num_roots != roots->count) {
+		log_debug("Application dirs changed, drun cache is stale.\n");
+		return false;
+	}
+	for (size_t i = 0; i < cache->num_dirs; i++) {
+		const struct drun_cache_dir *dir = &cache->dirs[i];
+		if (dir->parent != DRUN_CACHE_NONE) {
+			continue;
+		}
+		if (strcmp(dir->path, roots->buf[dir->root].string) != 0) {
+			log_debug("Application dirs changed, drun cache is stale.\n");
+			return false;
+		}
+	}
+	for (size_t i = 0; i < cache->num_dirs; i++) {
+		if (!dir_unchanged(&cache->dirs[i])) {
+			log_debug("%s changed, drun cache is stale.\n", cache->dirs[i].path);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Write cache to filename. The new file is written alongside and then renamed
+ * into place, so a concurrent reader never sees half of it.
+ */
+void drun_cache_save(const struct drun_cache *cache, const char *filename)
+{
+	struct cache_writer writer = cache_writer_create(64 * 1024);
+	cache_put(&writer, DRUN_CACHE_MAGIC, DRUN_CACHE_MAGIC_LENGTH);
+	cache_put_u32(&writer, DRUN_CACHE_VERSION);
+	cache_put_u32(&writer, cache->num_dirs);
+	cache_put_u32(&writer, cache->num_files);
+	cache_put_str(&writer, cache->languages);
+	for (size_t i = 0; i < cache->num_dirs; i++) {
+		const struct drun_cache_dir *dir = &cache->dirs[i];
+		cache_put_i64(&writer, dir->mtime_sec);
+		cache_put_i64(&writer, dir->mtime_nsec);
+		cache_put_u32(&writer, dir->root);
+		cache_put_u32(&writer, dir->parent);
+		cache_put_str(&writer, dir->path);
+	}
+	for (size_t i = 0; i < cache->num_files; i++) {
+		const struct drun_cache_file *file = &cache->files[i];
+		uint32_t flags = (file->valid ? FILE_VALID : 0)
+			| (file->info.hidden ? FILE_HIDDEN : 0)
+			| (file->shadowed ? FILE_SHADOWED : 0);
+		cache_put_u32(&writer, file->dir);
+		cache_put_u32(&writer, flags);
+		cache_put_i64(&writer, file->mtime_sec);
+		cache_put_i64(&writer, file->mtime_nsec);
+		cache_put_i64(&writer, file->size);
+		cache_put_i64(&writer, file->inode);
+		cache_put_str(&writer, file->id);
+		cache_put_str(&writer, file->path);
+		cache_put_str(&writer, file->info.name);
+		cache_put_str(&writer, file->info.icon);
+		cache_put_str(&writer, file->info.keywords);
+		cache_put_str(&writer, file->info.only_show_in);
+		cache_put_str(&writer, file->info.not_show_in);
+	}
+
+	if (cache_write_file(filename, "drun cache", &writer)) {
+		log_debug("Saved %zu files to drun cache.\n", cache->num_files);
+	}
+	cache_writer_destroy(&writer);
+}
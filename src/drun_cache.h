@@ -0,0 +1,99 @@
+#ifndef DRUN_CACHE_H
+#define DRUN_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "desktop_vec.h"
+#include "string_vec.h"
+
+/* Marks an application dir's lack of a parent. */
+#define DRUN_CACHE_NONE UINT32_MAX
+
+/* A directory we scanned, and when it was last modified at the time. */
+struct drun_cache_dir {
+	char *path;
+	/* -1 if the directory didn't exist. */
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	/* The application dir this is in, by its index in the search path. */
+	uint32_t root;
+	/* Index of the containing dir, or DRUN_CACHE_NONE for roots. */
+	uint32_t parent;
+};
+
+/* A .desktop file, and enough about it to tell if it's been modified. */
+struct drun_cache_file {
+	char *id;
+	char *path;
+	/* Index of the dir it's in. */
+	uint32_t dir;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t size;
+	uint64_t inode;
+	/* Whether the file could be parsed. If not, info is empty. */
+	bool valid;
+	/* Whether a file with the same ID takes precedence over this one. */
+	bool shadowed;
+	struct desktop_info info;
+};
+
+/*
+ * Everything drun_generate() finds out from the filesystem, before apps are
+ * filtered for the current desktop. This can be saved to disk and loaded back
+ * far faster than it can be rebuilt.
+ *
+ * Adding, removing or renaming a file changes its directory's mtime, so only
+ * directories whose mtime has changed need to be looked at again, and only
+ * files in them that have changed need to be parsed again.
+ */
+struct drun_cache {
+	/* The languages that names and keywords were localised for. */
+	char *languages;
+
+	/* Dirs are in the order they were scanned, parents first. */
+	size_t num_roots;
+	size_t num_dirs;
+	size_t dirs_size;
+	struct drun_cache_dir *dirs;
+
+	size_t num_files;
+	size_t files_size;
+	struct drun_cache_file *files;
+
+	/*
+	 * Strings live in the arena for a cache we've built, or the mapped
+	 * file for one we've loaded.
+	 */
+	struct arena arena;
+	void *map;
+	size_t map_size;
+};
+
+void drun_cache_init(struct drun_cache *cache, const char *languages);
+void drun_cache_destroy(struct drun_cache *cache);
+uint32_t drun_cache_add_dir(
+		struct drun_cache *cache,
+		const char *path,
+		const struct stat *st,
+		uint32_t root,
+		uint32_t parent);
+void drun_cache_add_file(struct drun_cache *cache, const struct drun_cache_file *file);
+void drun_cache_set_info(
+		struct drun_cache *cache,
+		size_t index,
+		bool valid,
+		const struct desktop_info *info);
+void drun_cache_resolve_ids(struct drun_cache *cache);
+
+bool drun_cache_load(struct drun_cache *cache, const char *filename);
+bool drun_cache_valid(
+		const struct drun_cache *cache,
+		const struct string_vec *roots,
+		const char *languages);
+void drun_cache_save(const struct drun_cache *cache, const char *filename);
+
+#endif /* DRUN_CACHE_H */
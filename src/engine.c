@@ -90,8 +90,8 @@ void engine_init(struct engine *engine, uint8_t *restrict buffer, uint32_t width
 
 	log_debug("Drawing window.\n");
 	/* Draw the background */
-  struct css_rule css_window = css_select(engine->css, "window");
-  struct color color = css_get_attr_color(&css_window, "background-color");
+  const struct css_rule *css_window = css_style(engine->css, CSS_STYLE_WINDOW);
+  struct color color = css_get_attr_color(css_window, CSS_BACKGROUND_COLOR);
 	cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_paint(cr);
@@ -250,8 +250,8 @@ void engine_update(struct engine *engine)
 	cairo_t *cr = engine->cairo[engine->index].cr;
 
 	/* Clear the image. */
-  struct css_rule css_window = css_select(engine->css, "window");
-  struct color color = css_get_attr_color(&css_window, "background-color");
+  const struct css_rule *css_window = css_style(engine->css, CSS_STYLE_WINDOW);
+  struct color color = css_get_attr_color(css_window, CSS_BACKGROUND_COLOR);
 	cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
 	cairo_save(cr);
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
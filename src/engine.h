@@ -8,6 +8,7 @@
 #include "color.h"
 #include "css.h"
 #include "desktop_vec.h"
+#include "filter_worker.h"
 #include "history.h"
 #include "entry.h"
 #include "surface.h"
@@ -42,6 +43,7 @@ struct engine {
 	struct entry_ref_vec results;
 	struct entry_ref_vec commands;
 	struct desktop_vec apps;
+	struct filter_worker filter_worker;
 	struct history history;
 	bool use_pango;
 
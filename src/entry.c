@@ -1,6 +1,7 @@
 
 #include <glib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,6 +15,19 @@
 #include "unicode.h"
 #include "xmalloc.h"
 
+#undef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#undef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/*
+ * How many results to put in order up front, and the minimum number to sort
+ * each time more are needed. This covers the first page or so of results,
+ * and keeps paging further down cheap.
+ */
+#define SORT_AHEAD 64
+
 static int cmpresultp(const void *restrict a, const void *restrict b)
 {
 	struct scored_entry *restrict res1 = (struct scored_entry *)a;
@@ -22,13 +36,13 @@ static int cmpresultp(const void *restrict a, const void *restrict b)
 	/*
 	 * Ensure any NULL strings are shoved to the end.
 	 */
-	if (res1->entry->name == NULL) {
+	if (res1->key->name_key.str == NULL) {
 		return 1;
 	}
-	if (res2->entry->name == NULL) {
+	if (res2->key->name_key.str == NULL) {
 		return -1;
 	}
-	return strcmp(res1->entry->name, res2->entry->name);
+	return strcmp(res1->key->name_key.str, res2->key->name_key.str);
 }
 
 static int cmpresultscorep(const void *restrict a, const void *restrict b)
@@ -54,6 +68,7 @@ struct entry_ref_vec entry_ref_vec_create(void)
 	struct entry_ref_vec vec = {
 		.count = 0,
 		.size = 128,
+		.sorted = 0,
 		.buf = xcalloc(128, sizeof(*vec.buf)),
 	};
 	return vec;
@@ -64,68 +79,75 @@ void entry_ref_vec_destroy(struct entry_ref_vec *restrict vec)
 	free(vec->buf);
 }
 
+/* Empty vec, but keep its buffer around for reuse. */
+void entry_ref_vec_clear(struct entry_ref_vec *restrict vec)
+{
+	vec->count = 0;
+	vec->sorted = 0;
+}
+
+/*
+ * Add an app's entry, which must already have been built with
+ * desktop_vec_build_entries(). Nothing is allocated besides room in vec.
+ */
 void entry_ref_vec_add_desktop(struct entry_ref_vec *restrict vec,
     struct desktop_entry *restrict des)
 {
-	if (vec->count == vec->size) {
-		vec->size *= 2;
-		vec->buf = xrealloc(vec->buf, vec->size * sizeof(vec->buf[0]));
-	}
-
-  struct entry *res = (struct entry*) malloc(sizeof(struct entry));
-
-	vec->buf[vec->count].entry = res;
-	vec->buf[vec->count].entry->name = des->name;
-	vec->buf[vec->count].entry->icon = &des->icon;
-	vec->buf[vec->count].entry->comment = des->comment;
-	vec->buf[vec->count].search_score = 0;
-	vec->buf[vec->count].history_score = 0;
-	vec->count++;
-
-  return res;
+	entry_ref_vec_add(vec, &des->entry->key);
+	vec->buf[vec->count - 1].history_score = des->history_score;
 }
 
 void entry_ref_vec_add(struct entry_ref_vec *restrict vec,
-    struct entry *restrict res)
+    struct entry_key *restrict key)
 {
 	if (vec->count == vec->size) {
 		vec->size *= 2;
 		vec->buf = xrealloc(vec->buf, vec->size * sizeof(vec->buf[0]));
 	}
-	vec->buf[vec->count].entry = res;
+	vec->buf[vec->count].key = key;
 	vec->buf[vec->count].search_score = 0;
 	vec->buf[vec->count].history_score = 0;
+	if (vec->sorted == vec->count) {
+		vec->sorted++;
+	}
 	vec->count++;
 }
 
-void scored_entry_history_sort(struct entry_ref_vec *restrict vec,
-    struct history *history)
+/*
+ * The full entry for key. Lines of input don't keep one, so theirs is built
+ * in line, and is only good until line is reused.
+ */
+struct entry *entry_from_key(struct entry_key *key, struct entry *line)
 {
-	/*
-	 * To find elements without assuming the vector is pre-sorted, we use a
-	 * hash table, which results in O(N+M) work (rather than O(N*M) for
-	 * linear search.
-	 */
-	GHashTable *hash = g_hash_table_new(g_str_hash, g_str_equal);
-	for (size_t i = 0; i < vec->count; i++) {
-		g_hash_table_insert(hash, vec->buf[i].entry->name, &vec->buf[i]);
+	if (key->entry != NULL) {
+		return key->entry;
 	}
-	for (size_t i = 0; i < history->count; i++) {
-		struct scored_entry *res = g_hash_table_lookup(hash, history->buf[i].name);
-		if (res == NULL) {
-			continue;
-		}
-		res->history_score = history->buf[i].run_count;
-	}
-	g_hash_table_unref(hash);
+	*line = (struct entry) {
+		.icon = NULL,
+		.name = (char *)key->name_key.str,
+		.name_length = key->name_length,
+		.comment = NULL,
+		.keywords = NULL,
+		.css_class = NULL
+	};
+	return line;
+}
 
+/*
+ * Put vec in order of the history scores already in it, e.g. from
+ * entry_ref_vec_add_desktop().
+ */
+void entry_ref_vec_history_sort(struct entry_ref_vec *restrict vec)
+{
 	qsort(vec->buf, vec->count, sizeof(vec->buf[0]), cmpresulthistoryp);
+	vec->sorted = vec->count;
 }
 
 struct scored_result *entry_vec_find_sorted(
     struct entry_ref_vec *restrict vec, const char * str)
 {
-  struct entry base = { .name = str };
+	struct entry_key key = { .name_key.str = str };
+	struct scored_entry base = { .key = &key };
 	return bsearch(&base, vec->buf, vec->count, sizeof(vec->buf[0]), cmpresultp);
 }
 
@@ -135,11 +157,12 @@ struct entry_ref_vec entry_ref_vec_copy(
 	struct entry_ref_vec copy = {
 		.count = vec->count,
 		.size = vec->size,
+		.sorted = vec->sorted,
 		.buf = xcalloc(vec->size, sizeof(*copy.buf)),
 	};
 
 	for (size_t i = 0; i < vec->count; i++) {
-		copy.buf[i].entry = vec->buf[i].entry;
+		copy.buf[i].key = vec->buf[i].key;
 		copy.buf[i].search_score = vec->buf[i].search_score;
 		copy.buf[i].history_score = vec->buf[i].history_score;
 	}
@@ -150,26 +173,174 @@ struct entry_ref_vec entry_ref_vec_copy(
 struct entry_ref_vec entry_ref_vec_filter(
 		const struct entry_ref_vec *restrict vec,
 		const char *restrict substr,
-		bool fuzzy)
+		enum matching_algorithm matching_algorithm)
 {
 	if (substr[0] == '\0') {
 		return entry_ref_vec_copy(vec);
 	}
 	struct entry_ref_vec filt = entry_ref_vec_create();
-	for (size_t i = 0; i < vec->count; i++) {
-		int32_t search_score;
-		if (fuzzy) {
-			search_score = fuzzy_match_words(substr, vec->buf[i].entry->name);
-		} else {
-			search_score = fuzzy_match_simple_words(substr, vec->buf[i].entry->name);
+	struct search_query query;
+	search_query_init(&query, substr, matching_algorithm);
+	entry_ref_vec_score(&filt, vec, 0, vec->count, &query);
+	search_query_destroy(&query);
+	entry_ref_vec_score_sort(&filt);
+	return filt;
+}
+
+/*
+ * Match entries [start, end) of vec against query, and append any matches to
+ * filt, unsorted. Only reads from vec, so several threads can score different
+ * ranges of the same vec at once.
+ */
+void entry_ref_vec_score(
+		struct entry_ref_vec *restrict filt,
+		const struct entry_ref_vec *restrict vec,
+		size_t start,
+		size_t end,
+		const struct search_query *restrict query)
+{
+	for (size_t i = start; i < end; i++) {
+		if ((i - start) % SEARCH_QUERY_CANCEL_INTERVAL == 0
+				&& search_query_cancelled(query)) {
+			return;
+		}
+		const struct entry_key *key = vec->buf[i].key;
+		const struct entry *entry = key->entry;
+		int32_t search_score = INT32_MIN;
+		if (search_key_covers(&key->name_key, query)) {
+			search_score = match_words(query, &key->name_key);
+		}
+		if (search_score == INT32_MIN
+				&& entry != NULL
+				&& entry->keywords != NULL
+				&& search_key_covers(&entry->keywords_key, query)) {
+			/* If we didn't match the name, check the keywords. */
+			search_score = match_words(query, &entry->keywords_key);
+			if (search_score != INT32_MIN) {
+				/* Same penalty as in desktop_vec_filter(). */
+				search_score -= 20;
+			}
 		}
 		if (search_score != INT32_MIN) {
-			entry_ref_vec_add(&filt, vec->buf[i].entry);
-			filt.buf[filt.count - 1].search_score = search_score;
-			filt.buf[filt.count - 1].history_score = vec->buf[i].history_score;
+			entry_ref_vec_add(filt, vec->buf[i].key);
+			filt->buf[filt->count - 1].search_score = search_score;
+			filt->buf[filt->count - 1].history_score = vec->buf[i].history_score;
 		}
 	}
-	/* Sort the results by their search score. */
-	qsort(filt.buf, filt.count, sizeof(filt.buf[0]), cmpresultscorep);
-	return filt;
+}
+
+static inline int64_t total_score(const struct scored_entry *res)
+{
+	return (int64_t)res->history_score + res->search_score;
+}
+
+static inline void swap_entries(struct scored_entry *a, struct scored_entry *b)
+{
+	struct scored_entry tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+/*
+ * Rearrange buf so that the k highest scoring of its count entries come
+ * first, in no particular order. This is Hoare's quickselect with a
+ * median-of-three pivot, so it's O(count) on average.
+ */
+static void select_top(struct scored_entry *buf, size_t count, size_t k)
+{
+	ptrdiff_t lo = 0;
+	ptrdiff_t hi = count;
+	while (hi - lo > 1) {
+		/* Move the median of the first, middle and last entries to lo. */
+		ptrdiff_t mid = lo + (hi - lo) / 2;
+		if (total_score(&buf[mid]) > total_score(&buf[hi - 1])) {
+			swap_entries(&buf[mid], &buf[hi - 1]);
+		}
+		if (total_score(&buf[lo]) > total_score(&buf[hi - 1])) {
+			swap_entries(&buf[lo], &buf[hi - 1]);
+		}
+		if (total_score(&buf[mid]) > total_score(&buf[lo])) {
+			swap_entries(&buf[mid], &buf[lo]);
+		}
+		const int64_t pivot = total_score(&buf[lo]);
+
+		/*
+		 * Partition so that everything in [lo, j] scores at least as
+		 * high as everything in (j, hi).
+		 */
+		ptrdiff_t i = lo - 1;
+		ptrdiff_t j = hi;
+		while (true) {
+			do {
+				i++;
+			} while (total_score(&buf[i]) > pivot);
+			do {
+				j--;
+			} while (total_score(&buf[j]) < pivot);
+			if (i >= j) {
+				break;
+			}
+			swap_entries(&buf[i], &buf[j]);
+		}
+
+		if ((ptrdiff_t)k <= j + 1) {
+			hi = j + 1;
+		} else {
+			lo = j + 1;
+		}
+	}
+}
+
+/*
+ * Make sure at least the first n entries of vec are in display order.
+ *
+ * Rather than sorting the whole vec, we pull the next highest scoring entries
+ * to the front of the unsorted part, and sort just those. Each call sorts at
+ * least as many as are already sorted, so paging through every result still
+ * costs O(count log count) overall.
+ */
+void entry_ref_vec_sort_to(struct entry_ref_vec *restrict vec, size_t n)
+{
+	if (n <= vec->sorted) {
+		return;
+	}
+	size_t target = MAX(n, vec->sorted + MAX(vec->sorted, SORT_AHEAD));
+	target = MIN(target, vec->count);
+
+	struct scored_entry *unsorted = &vec->buf[vec->sorted];
+	size_t num_unsorted = vec->count - vec->sorted;
+	size_t k = target - vec->sorted;
+	if (k < num_unsorted) {
+		select_top(unsorted, num_unsorted, k);
+	}
+	qsort(unsorted, k, sizeof(unsorted[0]), cmpresultscorep);
+	vec->sorted = target;
+}
+
+/*
+ * Mark the results as needing sorting by their search score, and sort the
+ * first few.
+ */
+void entry_ref_vec_score_sort(struct entry_ref_vec *restrict vec)
+{
+	vec->sorted = 0;
+	entry_ref_vec_sort_to(vec, SORT_AHEAD);
+}
+
+/* Append the contents of other to vec. */
+void entry_ref_vec_append(
+		struct entry_ref_vec *restrict vec,
+		const struct entry_ref_vec *restrict other)
+{
+	if (vec->count + other->count > vec->size) {
+		while (vec->count + other->count > vec->size) {
+			vec->size *= 2;
+		}
+		vec->buf = xrealloc(vec->buf, vec->size * sizeof(vec->buf[0]));
+	}
+	memcpy(&vec->buf[vec->count], other->buf, other->count * sizeof(other->buf[0]));
+	if (vec->sorted == vec->count && other->sorted == other->count) {
+		vec->sorted += other->count;
+	}
+	vec->count += other->count;
 }
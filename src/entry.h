@@ -2,27 +2,64 @@
 #define ENTRY_H
 
 #include "color.h"
-#include "css.h"
 #include "desktop_vec.h"
 #include "history.h"
 #include "icon.h"
+#include "search_key.h"
+
+struct desktop_entry;
+struct entry;
+
+/*
+ * What an entry is searched and ranked by. Lines of input are only this, and
+ * have a full entry built for them with entry_from_key() when they're drawn
+ * or submitted. An app's key is part of its full entry.
+ */
+struct entry_key {
+  /*
+   * The name's key. The name is name_length bytes long, and isn't
+   * necessarily NUL-terminated, as lines of a mapped input file point
+   * straight into the file.
+   */
+  struct search_key name_key;
+  size_t name_length;
+  /* The full entry this key belongs to, or NULL for a line of input. */
+  struct entry *entry;
+};
 
 struct entry {
+  struct entry_key key;
   struct icon *icon;
+  /* The same as key.name_key.str, and likewise not always terminated. */
   char *name;
+  size_t name_length;
   char *comment;
-  struct css_classes classes;
+  /* Secondary match target, NULL if there isn't one. */
+  char *keywords;
+  /* Search key, owned by whatever owns the strings. */
+  struct search_key keywords_key;
+  /* The entry's CSS class, or NULL for none. */
+  const char *css_class;
+  /* css_class as a class bit, for the stylesheet with css_generation. */
+  uint64_t css_classes;
+  uint32_t css_generation;
 };
 
 struct scored_entry {
-  struct entry *entry;
+  struct entry_key *key;
   int32_t search_score;
   int32_t history_score;
 };
 
+/*
+ * The first sorted entries of buf are in display order. Any entries after
+ * them are in no particular order yet, but none of them score higher, so
+ * they can be sorted on demand with entry_ref_vec_sort_to().
+ */
 struct entry_ref_vec {
   size_t count;
   size_t size;
+  size_t sorted;
   struct scored_entry *buf;
 };
 
@@ -31,20 +68,34 @@ struct entry_ref_vec entry_ref_vec_create(void);
 struct entry_ref_vec entry_ref_vec_copy(
     const struct entry_ref_vec *restrict vec);
 void entry_ref_vec_destroy(struct entry_ref_vec *restrict vec);
-void entry_ref_vec_history_sort(struct entry_ref_vec *restrict vec, struct history *history);
+void entry_ref_vec_clear(struct entry_ref_vec *restrict vec);
+void entry_ref_vec_history_sort(struct entry_ref_vec *restrict vec);
 struct scored_string_ref *entry_ref_vec_find_sorted(struct entry_ref_vec *restrict vec, const char *str);
 
 [[nodiscard("memory leaked")]]
 struct entry_ref_vec entry_ref_vec_filter(
 		const struct entry_ref_vec *restrict vec,
 		const char *restrict substr,
-		bool fuzzy);
+		enum matching_algorithm matching_algorithm);
+void entry_ref_vec_score(
+		struct entry_ref_vec *restrict filt,
+		const struct entry_ref_vec *restrict vec,
+		size_t start,
+		size_t end,
+		const struct search_query *restrict query);
+void entry_ref_vec_score_sort(struct entry_ref_vec *restrict vec);
+void entry_ref_vec_sort_to(struct entry_ref_vec *restrict vec, size_t n);
+void entry_ref_vec_append(
+		struct entry_ref_vec *restrict vec,
+		const struct entry_ref_vec *restrict other);
 
 [[nodiscard("memory leaked")]]
 struct entry_ref_vec entry_ref_vec_from_buffer(char *buffer);
 
 void entry_ref_vec_add(struct entry_ref_vec *restrict vec,
-    struct entry *restrict str);
+    struct entry_key *restrict key);
+
+struct entry *entry_from_key(struct entry_key *key, struct entry *line);
 
 void entry_ref_vec_add_desktop(struct entry_ref_vec *restrict vec,
     struct desktop_entry *restrict des);
@@ -0,0 +1,324 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "desktop_vec.h"
+#include "entry.h"
+#include "filter.h"
+#include "log.h"
+#include "search_key.h"
+#include "thread_pool.h"
+#include "xmalloc.h"
+
+/*
+ * How many chunks to split each parallel filter into per thread. Matching
+ * cost varies a lot between entries, so having a few more chunks than threads
+ * lets threads that finish early pick up the slack.
+ */
+#define CHUNKS_PER_THREAD 4
+
+struct filter_job {
+	/* Exactly one of apps and entries is set. */
+	const struct desktop_vec *apps;
+	const struct entry_ref_vec *entries;
+	size_t count;
+	const struct search_query *query;
+	size_t num_chunks;
+	struct entry_ref_vec *chunks;
+};
+
+static bool str_has_prefix(const char *str, const char *prefix)
+{
+	return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+static void filter_push(struct filter *filter, char *query, struct entry_ref_vec results)
+{
+	if (filter->depth == FILTER_STACK_SIZE) {
+		/*
+		 * Out of room, so forget the oldest result set. That's the
+		 * largest one, but it's also the one least likely to be
+		 * returned to.
+		 */
+		free(filter->stack[0].query);
+		entry_ref_vec_destroy(&filter->stack[0].results);
+		memmove(&filter->stack[0],
+				&filter->stack[1],
+				(FILTER_STACK_SIZE - 1) * sizeof(filter->stack[0]));
+		filter->depth--;
+	}
+	filter->stack[filter->depth].query = query;
+	filter->stack[filter->depth].results = results;
+	filter->depth++;
+}
+
+static void filter_pop_destroy(struct filter *filter)
+{
+	filter->depth--;
+	free(filter->stack[filter->depth].query);
+	entry_ref_vec_destroy(&filter->stack[filter->depth].results);
+}
+
+static void filter_chunk(void *arg, size_t index)
+{
+	struct filter_job *job = arg;
+	size_t start = job->count * index / job->num_chunks;
+	size_t end = job->count * (index + 1) / job->num_chunks;
+
+	entry_ref_vec_clear(&job->chunks[index]);
+	if (job->apps != NULL) {
+		desktop_vec_score(&job->chunks[index], job->apps, start, end, job->query);
+	} else {
+		entry_ref_vec_score(&job->chunks[index], job->entries, start, end, job->query);
+	}
+}
+
+/*
+ * Filter either apps or entries (whichever isn't NULL) against query, and
+ * store the result in results.
+ *
+ * Large lists are scored in chunks across the thread pool, and the per-chunk
+ * results concatenated before the usual sort.
+ *
+ * Returns false, with results left untouched, if filter->cancel was set
+ * before we finished.
+ */
+static bool filter_run(
+		struct filter *filter,
+		const struct desktop_vec *apps,
+		const struct entry_ref_vec *entries,
+		const char *query,
+		struct entry_ref_vec *results)
+{
+	if (query[0] == '\0') {
+		*results = entry_ref_vec_copy(entries);
+		return true;
+	}
+
+	size_t count = apps != NULL ? apps->count : entries->count;
+
+	if (filter->parallel_threshold > 0
+			&& count >= filter->parallel_threshold
+			&& filter->pool == NULL) {
+		size_t num_threads = thread_pool_default_size();
+		if (num_threads == 0) {
+			log_debug("Only one CPU, disabling parallel filtering.\n");
+			filter->parallel_threshold = 0;
+		} else {
+			filter->pool = thread_pool_create(num_threads);
+			filter->num_chunks = (filter->pool->num_threads + 1) * CHUNKS_PER_THREAD;
+			filter->chunks = xcalloc(filter->num_chunks, sizeof(*filter->chunks));
+			for (size_t i = 0; i < filter->num_chunks; i++) {
+				filter->chunks[i] = entry_ref_vec_create();
+			}
+		}
+	}
+
+	struct search_query compiled;
+	search_query_init(&compiled, query, filter->matching_algorithm);
+	compiled.cancel = filter->cancel;
+
+	struct entry_ref_vec filt = entry_ref_vec_create();
+	if (filter->parallel_threshold == 0 || count < filter->parallel_threshold) {
+		if (apps != NULL) {
+			desktop_vec_score(&filt, apps, 0, count, &compiled);
+		} else {
+			entry_ref_vec_score(&filt, entries, 0, count, &compiled);
+		}
+	} else {
+		struct filter_job job = {
+			.apps = apps,
+			.entries = entries,
+			.count = count,
+			.query = &compiled,
+			.num_chunks = filter->num_chunks,
+			.chunks = filter->chunks,
+		};
+		log_debug("Filtering %zu entries in %zu chunks.\n", count, job.num_chunks);
+		thread_pool_run(filter->pool, filter_chunk, &job, job.num_chunks);
+
+		for (size_t i = 0; i < job.num_chunks; i++) {
+			entry_ref_vec_append(&filt, &job.chunks[i]);
+		}
+	}
+
+	bool cancelled = search_query_cancelled(&compiled);
+	search_query_destroy(&compiled);
+	if (cancelled) {
+		log_debug("Filtering cancelled.\n");
+		entry_ref_vec_destroy(&filt);
+		return false;
+	}
+
+	entry_ref_vec_score_sort(&filt);
+	*results = filt;
+	return true;
+}
+
+/* Filter every entry against query, ignoring any previous results. */
+static bool filter_full(struct filter *filter, const char *query, struct entry_ref_vec *results)
+{
+	if (query[0] != '\0' && filter->drun) {
+		return filter_run(filter, filter->apps, NULL, query, results);
+	}
+	return filter_run(filter, NULL, filter->commands, query, results);
+}
+
+void filter_init(
+		struct filter *filter,
+		const struct desktop_vec *apps,
+		const struct entry_ref_vec *commands,
+		bool drun,
+		enum matching_algorithm matching_algorithm,
+		uint32_t parallel_threshold)
+{
+	*filter = (struct filter) {
+		.apps = apps,
+		.commands = commands,
+		.drun = drun,
+		.matching_algorithm = matching_algorithm,
+		.parallel_threshold = parallel_threshold,
+		.pool = NULL,
+		.num_chunks = 0,
+		.chunks = NULL,
+		.cancel = NULL,
+		.query = xstrdup(""),
+		.depth = 0
+	};
+}
+
+void filter_destroy(struct filter *filter)
+{
+	while (filter->depth > 0) {
+		filter_pop_destroy(filter);
+	}
+	free(filter->query);
+	if (filter->pool != NULL) {
+		thread_pool_destroy(filter->pool);
+	}
+	for (size_t i = 0; i < filter->num_chunks; i++) {
+		entry_ref_vec_destroy(&filter->chunks[i]);
+	}
+	free(filter->chunks);
+}
+
+/* Add the entries of added that match query to results. */
+static void filter_extend(
+		struct filter *filter,
+		struct entry_ref_vec *results,
+		const char *query,
+		const struct entry_ref_vec *added)
+{
+	if (query[0] == '\0') {
+		entry_ref_vec_append(results, added);
+		return;
+	}
+
+	struct search_query compiled;
+	search_query_init(&compiled, query, filter->matching_algorithm);
+	size_t count = results->count;
+	entry_ref_vec_score(results, added, 0, added->count, &compiled);
+	search_query_destroy(&compiled);
+
+	/* New matches may belong anywhere among the old ones. */
+	if (results->count != count) {
+		entry_ref_vec_score_sort(results);
+	}
+}
+
+/*
+ * Take account of entries that have just been added to the end of
+ * filter->commands, updating results (the result set for filter->query) and
+ * every stashed result set, so that the stack stays valid.
+ *
+ * Batches of new entries are small next to the whole list, so this can't be
+ * cancelled.
+ */
+void filter_append(
+		struct filter *filter,
+		struct entry_ref_vec *results,
+		const struct entry_ref_vec *added)
+{
+	filter_extend(filter, results, filter->query, added);
+	for (size_t i = 0; i < filter->depth; i++) {
+		struct filter_level *level = &filter->stack[i];
+		filter_extend(filter, &level->results, level->query, added);
+	}
+}
+
+/*
+ * Replace results, which must be the result set for filter->query, with the
+ * result set for query.
+ *
+ * Adding words or characters to a query can only ever remove matches, so if
+ * query extends the previous query we just re-score the previous results and
+ * stash them. Otherwise, we pop back to the longest stashed query that query
+ * still extends, and only fall back to scanning everything if there isn't
+ * one.
+ *
+ * Returns false if filtering was cancelled, in which case results and the
+ * filter are left as they were.
+ */
+bool filter_update(
+		struct filter *filter,
+		struct entry_ref_vec *results,
+		const char *query)
+{
+	if (!strcmp(query, filter->query)) {
+		return true;
+	}
+
+	if (str_has_prefix(query, filter->query)) {
+		log_debug("Refining %zu results.\n", results->count);
+		struct entry_ref_vec refined;
+		if (!filter_run(filter, NULL, results, query, &refined)) {
+			return false;
+		}
+		filter_push(filter, filter->query, *results);
+		filter->query = xstrdup(query);
+		*results = refined;
+		return true;
+	}
+
+	/* Find the longest stashed query that query still extends. */
+	size_t depth = filter->depth;
+	while (depth > 0 && !str_has_prefix(query, filter->stack[depth - 1].query)) {
+		depth--;
+	}
+
+	bool restore = depth > 0 && !strcmp(filter->stack[depth - 1].query, query);
+	struct entry_ref_vec filtered;
+	if (!restore) {
+		bool done;
+		if (depth == 0) {
+			log_debug("Filtering all entries.\n");
+			done = filter_full(filter, query, &filtered);
+		} else {
+			struct filter_level *level = &filter->stack[depth - 1];
+			log_debug("Refining %zu results.\n", level->results.count);
+			done = filter_run(filter, NULL, &level->results, query, &filtered);
+		}
+		if (!done) {
+			return false;
+		}
+	}
+
+	/* Nothing can be cancelled now, so drop the old state. */
+	entry_ref_vec_destroy(results);
+	free(filter->query);
+	while (filter->depth > depth) {
+		filter_pop_destroy(filter);
+	}
+
+	if (restore) {
+		/* We've been here before, so just reuse the old results. */
+		struct filter_level *top = &filter->stack[filter->depth - 1];
+		log_debug("Restoring %zu results.\n", top->results.count);
+		filter->depth--;
+		*results = top->results;
+		filter->query = top->query;
+	} else {
+		*results = filtered;
+		filter->query = xstrdup(query);
+	}
+	return true;
+}
@@ -0,0 +1,79 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "desktop_vec.h"
+#include "entry.h"
+#include "search_key.h"
+#include "thread_pool.h"
+
+/*
+ * The maximum number of previous result sets we keep around. Each one costs
+ * a pointer and two scores per match, so this is cheap compared to the
+ * rescan of every entry it saves when the user hits Backspace.
+ */
+#define FILTER_STACK_SIZE 16
+
+struct filter_level {
+	char *query;
+	struct entry_ref_vec results;
+};
+
+/*
+ * Incremental filter state.
+ *
+ * When the new query just extends the previous one, every possible match is
+ * already in the previous result set, so only that needs re-scoring. The
+ * previous result sets are kept on a small stack, so that deleting characters
+ * can pop back to them without rescanning anything.
+ */
+struct filter {
+	const struct desktop_vec *apps;
+	const struct entry_ref_vec *commands;
+	bool drun;
+	enum matching_algorithm matching_algorithm;
+
+	/*
+	 * Lists with at least this many entries are split across a pool of
+	 * threads, which is only started when first needed. 0 to disable.
+	 */
+	uint32_t parallel_threshold;
+	struct thread_pool *pool;
+
+	/*
+	 * Scratch result sets for each chunk of a parallel filter, emptied
+	 * and reused by every update rather than reallocated.
+	 */
+	size_t num_chunks;
+	struct entry_ref_vec *chunks;
+
+	/* If not NULL, setting this true abandons the current update. */
+	const atomic_bool *cancel;
+
+	/* The query that the current results correspond to. */
+	char *query;
+
+	size_t depth;
+	struct filter_level stack[FILTER_STACK_SIZE];
+};
+
+void filter_init(
+		struct filter *filter,
+		const struct desktop_vec *apps,
+		const struct entry_ref_vec *commands,
+		bool drun,
+		enum matching_algorithm matching_algorithm,
+		uint32_t parallel_threshold);
+void filter_destroy(struct filter *filter);
+bool filter_update(
+		struct filter *filter,
+		struct entry_ref_vec *results,
+		const char *query);
+void filter_append(
+		struct filter *filter,
+		struct entry_ref_vec *results,
+		const struct entry_ref_vec *added);
+
+#endif /* FILTER_H */
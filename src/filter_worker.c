@@ -0,0 +1,244 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <threads.h>
+#include <unistd.h>
+#include "entry.h"
+#include "filter.h"
+#include "filter_worker.h"
+#include "log.h"
+#include "xmalloc.h"
+
+static void notify(struct filter_worker *worker)
+{
+	uint64_t one = 1;
+	if (write(worker->event_fd, &one, sizeof(one)) != sizeof(one)) {
+		log_error("Failed to signal filter results: %s.\n", strerror(errno));
+	}
+}
+
+static int worker_run(void *data)
+{
+	struct filter_worker *worker = data;
+
+	mtx_lock(&worker->lock);
+	while (true) {
+		while (!worker->quit
+				&& worker->pending == NULL
+				&& worker->added.count == 0) {
+			cnd_wait(&worker->wake, &worker->lock);
+		}
+		if (worker->quit) {
+			break;
+		}
+
+		char *query = worker->pending;
+		uint64_t generation = worker->generation;
+		struct entry_ref_vec added = worker->added;
+		worker->added = entry_ref_vec_create();
+		worker->pending = NULL;
+		worker->busy = true;
+		atomic_store_explicit(&worker->cancel, false, memory_order_relaxed);
+		mtx_unlock(&worker->lock);
+
+		/*
+		 * Take in any new entries first, so that the new query (if
+		 * there is one) covers them too.
+		 */
+		bool done = false;
+		if (added.count > 0) {
+			entry_ref_vec_append(&worker->commands, &added);
+			filter_append(&worker->filter, &worker->results, &added);
+			done = true;
+		}
+		entry_ref_vec_destroy(&added);
+		if (query != NULL) {
+			done = filter_update(&worker->filter, &worker->results, query);
+			free(query);
+		}
+
+		/* Don't bother handing over results that are already stale. */
+		mtx_lock(&worker->lock);
+		bool current = done && worker->generation == generation;
+		mtx_unlock(&worker->lock);
+
+		/*
+		 * We keep our own results to refine next time, so hand the
+		 * main thread a copy. This goes in the back buffer, which is
+		 * swapped with ready under the lock, so no buffer is allocated
+		 * or freed per hand-off.
+		 */
+		if (current) {
+			entry_ref_vec_clear(&worker->back);
+			entry_ref_vec_append(&worker->back, &worker->results);
+			worker->back.sorted = worker->results.sorted;
+		}
+
+		mtx_lock(&worker->lock);
+		worker->busy = false;
+		if (current) {
+			/*
+			 * If the main thread never collected the last results,
+			 * they just become the next back buffer.
+			 */
+			struct entry_ref_vec tmp = worker->ready;
+			worker->ready = worker->back;
+			worker->back = tmp;
+			worker->ready_generation = generation;
+			worker->have_results = true;
+			notify(worker);
+		}
+		if (worker->pending == NULL && worker->added.count == 0) {
+			cnd_broadcast(&worker->idle);
+		}
+	}
+	mtx_unlock(&worker->lock);
+	return 0;
+}
+
+/*
+ * Start filtering on a background thread. The worker keeps its own copy of
+ * commands, which filter_worker_append() can add to later. The initial result
+ * set is a copy of commands, i.e. the results for an empty query.
+ */
+void filter_worker_start(
+		struct filter_worker *worker,
+		const struct desktop_vec *apps,
+		const struct entry_ref_vec *commands,
+		bool drun,
+		enum matching_algorithm matching_algorithm,
+		uint32_t parallel_threshold)
+{
+	*worker = (struct filter_worker) {
+		.commands = entry_ref_vec_copy(commands),
+		.results = entry_ref_vec_copy(commands),
+		.added = entry_ref_vec_create(),
+		.ready = entry_ref_vec_create(),
+		.back = entry_ref_vec_create(),
+		.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK),
+	};
+	filter_init(
+			&worker->filter,
+			apps,
+			&worker->commands,
+			drun,
+			matching_algorithm,
+			parallel_threshold);
+	worker->filter.cancel = &worker->cancel;
+	atomic_init(&worker->cancel, false);
+
+	if (worker->event_fd == -1) {
+		log_error("Failed to create eventfd: %s.\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	mtx_init(&worker->lock, mtx_plain);
+	cnd_init(&worker->wake);
+	cnd_init(&worker->idle);
+	if (thrd_create(&worker->thread, worker_run, worker) != thrd_success) {
+		log_error("Failed to start filter thread.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void filter_worker_stop(struct filter_worker *worker)
+{
+	mtx_lock(&worker->lock);
+	worker->quit = true;
+	atomic_store_explicit(&worker->cancel, true, memory_order_relaxed);
+	cnd_signal(&worker->wake);
+	mtx_unlock(&worker->lock);
+	thrd_join(worker->thread, NULL);
+
+	free(worker->pending);
+	entry_ref_vec_destroy(&worker->ready);
+	entry_ref_vec_destroy(&worker->back);
+	entry_ref_vec_destroy(&worker->added);
+	entry_ref_vec_destroy(&worker->results);
+	entry_ref_vec_destroy(&worker->commands);
+	filter_destroy(&worker->filter);
+	cnd_destroy(&worker->idle);
+	cnd_destroy(&worker->wake);
+	mtx_destroy(&worker->lock);
+	close(worker->event_fd);
+}
+
+/*
+ * Ask for the results for query, abandoning any previous request.
+ */
+void filter_worker_submit(struct filter_worker *worker, const char *query)
+{
+	mtx_lock(&worker->lock);
+	free(worker->pending);
+	worker->pending = xstrdup(query);
+	worker->generation++;
+	atomic_store_explicit(&worker->cancel, true, memory_order_relaxed);
+	cnd_signal(&worker->wake);
+	mtx_unlock(&worker->lock);
+}
+
+/*
+ * Add entries to the end of the list being filtered. Unlike a new query, this
+ * doesn't interrupt any filter in progress.
+ */
+void filter_worker_append(struct filter_worker *worker, const struct entry_ref_vec *added)
+{
+	if (added->count == 0) {
+		return;
+	}
+	mtx_lock(&worker->lock);
+	entry_ref_vec_append(&worker->added, added);
+	cnd_signal(&worker->wake);
+	mtx_unlock(&worker->lock);
+}
+
+/*
+ * If there are new results, swap them into results and return true.
+ *
+ * These may be for an older query than the latest one submitted, if the user
+ * is still typing, but that's fine to show in the meantime. If they're for
+ * the same query as the last results collected, collected_generation doesn't
+ * change, and the only difference is that entries have been added.
+ */
+bool filter_worker_collect(struct filter_worker *worker, struct entry_ref_vec *results)
+{
+	uint64_t value;
+	while (read(worker->event_fd, &value, sizeof(value)) > 0) {
+		/* Just draining the eventfd. */
+	}
+
+	bool collected = false;
+	mtx_lock(&worker->lock);
+	if (worker->have_results) {
+		/* Our old results become the worker's spare buffer. */
+		struct entry_ref_vec tmp = *results;
+		*results = worker->ready;
+		worker->ready = tmp;
+		worker->collected_generation = worker->ready_generation;
+		worker->have_results = false;
+		collected = true;
+	}
+	mtx_unlock(&worker->lock);
+	return collected;
+}
+
+/*
+ * Block until the results for the latest query, including every entry
+ * appended so far, are ready, and swap them into results if they're not
+ * there already. Returns true if results changed.
+ */
+bool filter_worker_wait(struct filter_worker *worker, struct entry_ref_vec *results)
+{
+	mtx_lock(&worker->lock);
+	while (worker->busy
+			|| worker->pending != NULL
+			|| worker->added.count > 0) {
+		cnd_wait(&worker->idle, &worker->lock);
+	}
+	mtx_unlock(&worker->lock);
+	return filter_worker_collect(worker, results);
+}
@@ -0,0 +1,80 @@
+#ifndef FILTER_WORKER_H
+#define FILTER_WORKER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+#include "desktop_vec.h"
+#include "entry.h"
+#include "filter.h"
+#include "search_key.h"
+
+/*
+ * Runs a struct filter on a background thread, so that slow filtering never
+ * holds up typing or drawing.
+ *
+ * The main thread submits each new query, which cancels whatever filter is
+ * in progress. When results are ready, event_fd becomes readable, and the
+ * main thread picks them up with filter_worker_collect().
+ */
+struct filter_worker {
+	/* Only touched by the worker thread once it's started. */
+	struct filter filter;
+	struct entry_ref_vec commands;
+	struct entry_ref_vec results;
+
+	/* Where the next copy of results for the main thread is built. */
+	struct entry_ref_vec back;
+
+	thrd_t thread;
+	int event_fd;
+	atomic_bool cancel;
+
+	/* Everything below is protected by lock. */
+	mtx_t lock;
+	cnd_t wake;
+	cnd_t idle;
+	bool quit;
+	bool busy;
+
+	/*
+	 * The latest query, if the worker hasn't picked it up yet, and a
+	 * count of queries submitted so far.
+	 */
+	char *pending;
+	uint64_t generation;
+
+	/* Entries waiting to be added to the end of commands. */
+	struct entry_ref_vec added;
+
+	/*
+	 * Finished results that the main thread hasn't collected yet, if
+	 * have_results is set, and the generation of the query they're for.
+	 * Otherwise, ready is just a spare buffer.
+	 */
+	bool have_results;
+	struct entry_ref_vec ready;
+	uint64_t ready_generation;
+
+	/*
+	 * The generation of the query the last collected results were for.
+	 * Only touched by the main thread.
+	 */
+	uint64_t collected_generation;
+};
+
+void filter_worker_start(
+		struct filter_worker *worker,
+		const struct desktop_vec *apps,
+		const struct entry_ref_vec *commands,
+		bool drun,
+		enum matching_algorithm matching_algorithm,
+		uint32_t parallel_threshold);
+void filter_worker_stop(struct filter_worker *worker);
+void filter_worker_submit(struct filter_worker *worker, const char *query);
+void filter_worker_append(struct filter_worker *worker, const struct entry_ref_vec *added);
+bool filter_worker_collect(struct filter_worker *worker, struct entry_ref_vec *results);
+bool filter_worker_wait(struct filter_worker *worker, struct entry_ref_vec *results);
+
+#endif /* FILTER_WORKER_H */
@@ -1,90 +1,159 @@
-#include <ctype.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
+#include "ascii_search.h"
 #include "fuzzy_match.h"
-#include "unicode.h"
-#include "xmalloc.h"
+#include "search_key.h"
 
 #undef MAX
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+/*
+ * The longest single word fuzzy_match_dp() will handle before falling back to
+ * fuzzy_match(). This matches the input length limit, so shouldn't be hit.
+ */
+#define MAX_PATTERN_LENGTH 256
+
 static int32_t compute_score(
 		int32_t jump,
 		bool first_char,
-		const char *restrict match);
+		const struct search_key *restrict key,
+		size_t match);
 
 static int32_t fuzzy_match_recurse(
-		const char *restrict pattern,
-		const char *restrict str,
+		const uint32_t *restrict pattern,
+		size_t plen,
+		const struct search_key *restrict key,
+		size_t start,
 		int32_t score,
 		bool first_match_only,
 		bool first_char);
 
 /*
- * Split patterns into words, and perform simple matching against str for each.
- * Returns the sum of substring distances from the start of str.
+ * Return the index of the first character of key at or after start that
+ * matches the (lowercase) character c, or key->length if there isn't one.
+ */
+static inline size_t find_char(const struct search_key *restrict key, size_t start, uint32_t c)
+{
+	if (key->ascii) {
+		if (c >= 0x80) {
+			return key->length;
+		}
+		const char *match = ascii_strcasechr(&key->str[start], key->length - start, c);
+		if (match == NULL) {
+			return key->length;
+		}
+		return match - key->str;
+	}
+	while (start < key->length && key->chars[start] != c) {
+		start++;
+	}
+	return start;
+}
+
+/*
+ * Perform simple matching of each word of query against key.
+ * Returns the sum of substring distances from the start of the string.
  * If a word is not found, returns INT32_MIN.
  */
-int32_t fuzzy_match_simple_words(const char *restrict patterns, const char *restrict str)
+int32_t fuzzy_match_simple_words(
+		const struct search_query *restrict query,
+		const struct search_key *restrict key)
 {
 	int32_t score = 0;
-	char *saveptr = NULL;
-	char *tmp = utf8_normalize(patterns);
-	char *pattern = strtok_r(tmp, " ", &saveptr);
-	while (pattern != NULL) {
-		char *c = utf8_strcasestr(str, pattern);
-		if (c == NULL) {
-			score = INT32_MIN;
-			break;
+	for (size_t i = 0; i < query->count; i++) {
+		const struct search_word *word = &query->words[i];
+		const char *c;
+		if (key->ascii) {
+			if (!word->ascii) {
+				/* Nothing non-ASCII can be found in an ASCII string. */
+				return INT32_MIN;
+			}
+			c = ascii_strcasestr(key->str, key->length, word->folded, word->folded_length);
+			if (c == NULL) {
+				return INT32_MIN;
+			}
+			score += key->str - c;
 		} else {
-			score += str - c;
+			c = strstr(key->folded, word->folded);
+			if (c == NULL) {
+				return INT32_MIN;
+			}
+			score += key->folded - c;
 		}
-		pattern = strtok_r(NULL, " ", &saveptr);
 	}
-	free(tmp);
 	return score;
 }
 
 
 /*
- * Split patterns into words, and return the sum of fuzzy_match(word, str).
+ * Return the sum of fuzzy_match(word, key) for each word of query.
  * If a word is not found, returns INT32_MIN.
  */
-int32_t fuzzy_match_words(const char *restrict patterns, const char *restrict str)
+int32_t fuzzy_match_words(
+		const struct search_query *restrict query,
+		const struct search_key *restrict key)
 {
 	int32_t score = 0;
-	char *saveptr = NULL;
-	char *tmp = utf8_normalize(patterns);
-	char *pattern = strtok_r(tmp, " ", &saveptr);
-	while (pattern != NULL) {
-		int32_t word_score = fuzzy_match(pattern, str);
+	for (size_t i = 0; i < query->count; i++) {
+		int32_t word_score = fuzzy_match(&query->words[i], key);
 		if (word_score == INT32_MIN) {
-			score = INT32_MIN;
-			break;
-		} else {
-			score += word_score;
+			return INT32_MIN;
 		}
-		pattern = strtok_r(NULL, " ", &saveptr);
+		score += word_score;
 	}
-	free(tmp);
 	return score;
 }
 
 /*
- * Returns score if each character in pattern is found sequentially within str.
+ * As fuzzy_match_words(), but using fuzzy_match_dp() for each word.
+ */
+int32_t fuzzy_match_words_dp(
+		const struct search_query *restrict query,
+		const struct search_key *restrict key)
+{
+	int32_t score = 0;
+	for (size_t i = 0; i < query->count; i++) {
+		int32_t word_score = fuzzy_match_dp(&query->words[i], key);
+		if (word_score == INT32_MIN) {
+			return INT32_MIN;
+		}
+		score += word_score;
+	}
+	return score;
+}
+
+int32_t match_words(
+		const struct search_query *restrict query,
+		const struct search_key *restrict key)
+{
+	switch (query->algorithm) {
+		case MATCHING_ALGORITHM_NORMAL:
+			return fuzzy_match_simple_words(query, key);
+		case MATCHING_ALGORITHM_FUZZY:
+			return fuzzy_match_words(query, key);
+		case MATCHING_ALGORITHM_FUZZY_DP:
+			return fuzzy_match_words_dp(query, key);
+	}
+	return INT32_MIN;
+}
+
+/*
+ * Returns score if each character in word is found sequentially within key.
  * Returns INT32_MIN otherwise.
  */
-int32_t fuzzy_match(const char *restrict pattern, const char *restrict str)
+int32_t fuzzy_match(
+		const struct search_word *restrict word,
+		const struct search_key *restrict key)
 {
 	const int unmatched_letter_penalty = -1;
-	const size_t slen = utf8_strlen(str);
-	const size_t plen = utf8_strlen(pattern);
+	const size_t slen = key->length;
+	const size_t plen = word->length;
 	int32_t score = 0;
 
-	if (*pattern == '\0') {
+	if (plen == 0) {
 		return score;
 	}
 	if (slen < plen) {
@@ -119,54 +188,53 @@ int32_t fuzzy_match(const char *restrict pattern, const char *restrict str)
         bool first_match_only = slen > 100;
 
 	/* Perform the match. */
-	score = fuzzy_match_recurse(pattern, str, score, first_match_only, true);
+	score = fuzzy_match_recurse(word->chars, plen, key, 0, score, first_match_only, true);
 
 	return score;
 }
 
 /*
- * Recursively match the whole of pattern against str.
+ * Recursively match the whole of pattern against key, starting from the
+ * character at index start.
  * The score parameter is the score of the previously matched character.
  *
- * This reaches a maximum recursion depth of strlen(pattern) + 1. However, the
- * stack usage is small (the maximum I've seen on x86_64 is 144 bytes with
- * gcc -O3), so this shouldn't matter unless pattern contains thousands of
- * characters.
+ * This reaches a maximum recursion depth of plen + 1. However, the stack usage
+ * is small (the maximum I've seen on x86_64 is 144 bytes with gcc -O3), so
+ * this shouldn't matter unless pattern contains thousands of characters.
  */
 int32_t fuzzy_match_recurse(
-		const char *restrict pattern,
-		const char *restrict str,
+		const uint32_t *restrict pattern,
+		size_t plen,
+		const struct search_key *restrict key,
+		size_t start,
 		int32_t score,
 		bool first_match_only,
 		bool first_char)
 {
-	if (*pattern == '\0') {
+	if (plen == 0) {
 		/* We've matched the full pattern. */
 		return score;
 	}
 
-	const char *match = str;
-	uint32_t search = utf8_to_utf32(pattern);
-
 	int32_t best_score = INT32_MIN;
 
 	/*
-	 * Find all occurrences of the next pattern character in str, and
+	 * Find all occurrences of the next pattern character in the key, and
 	 * recurse on them.
 	 */
-	while ((match = utf8_strcasechr(match, search)) != NULL) {
-		int32_t jump = 0;
-		for (const char *tmp = str; tmp != match; tmp = utf8_next_char(tmp)) {
-			jump++;
-		}
+	for (size_t match = find_char(key, start, pattern[0]);
+			match < key->length;
+			match = find_char(key, match + 1, pattern[0])) {
+		int32_t jump = match - start;
 		int32_t subscore = fuzzy_match_recurse(
-				utf8_next_char(pattern),
-				utf8_next_char(match),
-				compute_score(jump, first_char, match),
+				pattern + 1,
+				plen - 1,
+				key,
+				match + 1,
+				compute_score(jump, first_char, key, match),
 				first_match_only,
 				false);
 		best_score = MAX(best_score, subscore);
-		match = utf8_next_char(match);
 
 		if (first_match_only) {
 			break;
@@ -181,6 +249,88 @@ int32_t fuzzy_match_recurse(
 	}
 }
 
+/*
+ * Find the best fuzzy match of word in key, with the same scoring as
+ * fuzzy_match(), but in O(word->length * key->length) time.
+ *
+ * This is a Smith-Waterman style dynamic programme. Let M[i][j] be the best
+ * score for matching the first i + 1 characters of word, with word[i] matched
+ * to key[j]. The bonuses from compute_score() only depend on the gap since the
+ * previous match through whether it's zero, so:
+ *
+ *   M[i][j] = max(M[i-1][j-1] + compute_score(0, ...),
+ *                 max(M[i-1][k] for k < j-1) + compute_score(1, ...))
+ *
+ * We walk the key once, keeping just the latest column of M and the running
+ * maximum of each row, so the only scratch space needed is a couple of small
+ * fixed-size arrays indexed by word position. Unlike fuzzy_match(), there's
+ * no need to give up and take the first match for long strings.
+ */
+int32_t fuzzy_match_dp(
+		const struct search_word *restrict word,
+		const struct search_key *restrict key)
+{
+	const int unmatched_letter_penalty = -1;
+	const uint32_t *pat = word->chars;
+	const size_t plen = word->length;
+	const size_t slen = key->length;
+
+	if (plen == 0) {
+		return 0;
+	}
+	if (slen < plen) {
+		return INT32_MIN;
+	}
+	if (plen > MAX_PATTERN_LENGTH) {
+		return fuzzy_match(word, key);
+	}
+
+	/*
+	 * last[i] is M[i][j-1], and best[i] is the maximum of M[i][k] for
+	 * k < j-1, where j is the index of the current character of the key.
+	 */
+	int32_t last[MAX_PATTERN_LENGTH];
+	int32_t best[MAX_PATTERN_LENGTH];
+	for (size_t i = 0; i < plen; i++) {
+		last[i] = INT32_MIN;
+		best[i] = INT32_MIN;
+	}
+
+	for (size_t j = 0; j < slen; j++) {
+		const uint32_t cur = search_key_char(key, j);
+
+		/*
+		 * Walk backwards through the word, so that row i - 1 still
+		 * holds the previous column when row i reads it.
+		 */
+		for (size_t i = plen; i-- > 0;) {
+			int32_t score = INT32_MIN;
+			if (pat[i] == cur) {
+				if (i == 0) {
+					score = compute_score(j, true, key, j);
+				} else {
+					if (last[i - 1] != INT32_MIN) {
+						score = last[i - 1] + compute_score(0, false, key, j);
+					}
+					if (best[i - 1] != INT32_MIN) {
+						score = MAX(score, best[i - 1] + compute_score(1, false, key, j));
+					}
+				}
+			}
+			best[i] = MAX(best[i], last[i]);
+			last[i] = score;
+		}
+	}
+
+	int32_t score = MAX(best[plen - 1], last[plen - 1]);
+	if (score == INT32_MIN) {
+		return INT32_MIN;
+	}
+
+	/* Penalise any unused letters, as in fuzzy_match(). */
+	return score + unmatched_letter_penalty * (int32_t)(slen - plen);
+}
+
 /*
  * Calculate the score for a single matching letter.
  * The scoring system is taken from fts_fuzzy_match v0.2.0 by Forrest Smith,
@@ -196,7 +346,11 @@ int32_t fuzzy_match_recurse(
  *     - If there are letters before the first match.
  *     - If there are superfluous characters in str (already accounted for).
  */
-int32_t compute_score(int32_t jump, bool first_char, const char *restrict match)
+int32_t compute_score(
+		int32_t jump,
+		bool first_char,
+		const struct search_key *restrict key,
+		size_t match)
 {
 	const int adjacency_bonus = 15;
 	const int separator_bonus = 30;
@@ -208,18 +362,18 @@ int32_t compute_score(int32_t jump, bool first_char, const char *restrict match)
 
 	int32_t score = 0;
 
-	const uint32_t cur = utf8_to_utf32(match);
+	const uint8_t cur = search_key_flags(key, match);
 
 	/* Apply bonuses. */
 	if (!first_char && jump == 0) {
 		score += adjacency_bonus;
 	}
 	if (!first_char || jump > 0) {
-		const uint32_t prev = utf8_to_utf32(utf8_prev_char(match));
-		if (utf32_isupper(cur) && utf32_islower(prev)) {
+		const uint8_t prev = search_key_flags(key, match - 1);
+		if ((cur & SEARCH_KEY_UPPER) && (prev & SEARCH_KEY_LOWER)) {
 			score += camel_bonus;
 		}
-		if (utf32_isalnum(cur) && !utf32_isalnum(prev)) {
+		if ((cur & SEARCH_KEY_ALNUM) && !(prev & SEARCH_KEY_ALNUM)) {
 			score += separator_bonus;
 		}
 	}
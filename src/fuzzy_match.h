@@ -2,9 +2,25 @@
 #define FUZZY_MATCH_H
 
 #include <stdint.h>
+#include "search_key.h"
 
-int32_t fuzzy_match_simple_words(const char *restrict patterns, const char *restrict str);
-int32_t fuzzy_match_words(const char *restrict patterns, const char *restrict str);
-int32_t fuzzy_match(const char *restrict pattern, const char *restrict str);
+int32_t fuzzy_match_simple_words(
+		const struct search_query *restrict query,
+		const struct search_key *restrict key);
+int32_t fuzzy_match_words(
+		const struct search_query *restrict query,
+		const struct search_key *restrict key);
+int32_t fuzzy_match_words_dp(
+		const struct search_query *restrict query,
+		const struct search_key *restrict key);
+int32_t fuzzy_match(
+		const struct search_word *restrict word,
+		const struct search_key *restrict key);
+int32_t fuzzy_match_dp(
+		const struct search_word *restrict word,
+		const struct search_key *restrict key);
+int32_t match_words(
+		const struct search_query *restrict query,
+		const struct search_key *restrict key);
 
 #endif /* FUZZY_MATCH_H */
@@ -3,6 +3,7 @@
 #include <linux/input-event-codes.h>
 #include <unistd.h>
 #include "desktop_vec.h"
+#include "filter_worker.h"
 #include "input.h"
 #include "log.h"
 #include "nelem.h"
@@ -145,15 +146,7 @@ void add_character(struct tofi *tofi, xkb_keycode_t keycode)
 				N_ELEM(buf));
 		engine->input_utf8_length += len;
 
-		if (engine->drun) {
-			struct entry_ref_vec results = desktop_vec_filter(&engine->apps, engine->input_utf8, tofi->fuzzy_match);
-			entry_ref_vec_destroy(&engine->results);
-			engine->results = results;
-		} else {
-//			struct string_ref_vec tmp = engine->results;
-//			engine->results = string_ref_vec_filter(&engine->results, engine->input_utf8, tofi->fuzzy_match);
-//			string_ref_vec_destroy(&tmp);
-		}
+		filter_worker_submit(&engine->filter_worker, engine->input_utf8);
 
 		reset_selection(tofi);
 	} else {
@@ -182,16 +175,88 @@ void input_refresh_results(struct tofi *tofi)
 	}
 	engine->input_utf8[bytes_written] = '\0';
 	engine->input_utf8_length = bytes_written;
-	entry_ref_vec_destroy(&engine->results);
-	if (engine->drun) {
-		engine->results = desktop_vec_filter(&engine->apps, engine->input_utf8, tofi->fuzzy_match);
-	} else {
-		//engine->results = string_ref_vec_filter(&engine->commands, engine->input_utf8, tofi->fuzzy_match);
-	}
+	filter_worker_submit(&engine->filter_worker, engine->input_utf8);
 
 	reset_selection(tofi);
 }
 
+/*
+ * Select entry again after results have been added to, showing it where it
+ * now ranks if that's on the first page, or on the same row otherwise.
+ * Returns false if it's not among the results any more.
+ */
+static bool reselect(struct engine *engine, const struct entry_key *key)
+{
+	struct entry_ref_vec *results = &engine->results;
+	for (size_t i = 0; i < results->count; i++) {
+		if (i == results->sorted) {
+			entry_ref_vec_sort_to(results, i + 1);
+		}
+		if (results->buf[i].key != key) {
+			continue;
+		}
+		if (i < engine->num_results_drawn || i < engine->selection) {
+			engine->first_result = 0;
+			engine->selection = i;
+		} else {
+			engine->first_result = i - engine->selection;
+		}
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Swap in any new results from the filter thread, waiting for the results
+ * for the latest query if wait is set. Results for a new query start again
+ * from the top, but if they're for the same query as before, only more input
+ * has arrived, so the same entry stays selected. Returns true if the results
+ * changed.
+ */
+static bool take_results(struct tofi *tofi, bool wait)
+{
+	struct engine *engine = &tofi->window.engine;
+	struct filter_worker *worker = &engine->filter_worker;
+
+	uint64_t generation = worker->collected_generation;
+	const struct entry_key *selected = NULL;
+	size_t index = engine->first_result + engine->selection;
+	if (index < engine->results.count) {
+		entry_ref_vec_sort_to(&engine->results, index + 1);
+		selected = engine->results.buf[index].key;
+	}
+
+	bool changed = wait
+		? filter_worker_wait(worker, &engine->results)
+		: filter_worker_collect(worker, &engine->results);
+	if (!changed) {
+		return false;
+	}
+	if (selected == NULL
+			|| worker->collected_generation != generation
+			|| !reselect(engine, selected)) {
+		reset_selection(tofi);
+	}
+	return true;
+}
+
+/*
+ * Pick up any results the filter thread has finished, and redraw if there
+ * were some.
+ */
+void input_receive_results(struct tofi *tofi)
+{
+	if (take_results(tofi, false)) {
+		tofi->window.surface.redraw = true;
+	}
+}
+
+/* Wait for the results for the latest query, e.g. before submitting. */
+void input_wait_results(struct tofi *tofi)
+{
+	take_results(tofi, true);
+}
+
 void delete_character(struct tofi *tofi)
 {
 	struct engine *engine = &tofi->window.engine;
@@ -6,5 +6,7 @@
 
 void input_handle_keypress(struct tofi *tofi, xkb_keycode_t keycode);
 void input_refresh_results(struct tofi *tofi);
+void input_receive_results(struct tofi *tofi);
+void input_wait_results(struct tofi *tofi);
 
 #endif /* INPUT_H */
@@ -0,0 +1,280 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arena.h"
+#include "entry.h"
+#include "history.h"
+#include "line_reader.h"
+#include "log.h"
+#include "search_key.h"
+#include "unicode.h"
+#include "xmalloc.h"
+
+#define READ_SIZE (64 * 1024)
+
+/*
+ * The most we read (or scan of a mapped file) in one go before handing back
+ * to the main loop, so that a fast producer can't stop us from responding to
+ * input.
+ */
+#define READ_LIMIT (1024 * 1024)
+
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+/* Look up name's run count in history, or 0 if it's not there. */
+static int32_t history_score(struct line_reader *reader, const char *name, size_t length)
+{
+	if (reader->history == NULL) {
+		return 0;
+	}
+	/* Names may point into a mapped file, so look up a terminated copy. */
+	if (length + 1 > reader->scratch_size) {
+		reader->scratch_size = 2 * (length + 1);
+		reader->scratch = xrealloc(reader->scratch, reader->scratch_size);
+	}
+	memcpy(reader->scratch, name, length);
+	reader->scratch[length] = '\0';
+	struct program *program = g_hash_table_lookup(reader->history, reader->scratch);
+	if (program == NULL) {
+		return 0;
+	}
+	return program->run_count;
+}
+
+/*
+ * Add a key for the length bytes of name, which must live as long as the
+ * reader does. Only ASCII names can be left unterminated. Lines don't get a
+ * full entry, as only the few that are drawn or submitted ever need one.
+ */
+static void add_key(
+		struct line_reader *reader,
+		struct entry_ref_vec *added,
+		char *name,
+		size_t length,
+		bool ascii)
+{
+	struct entry_key *key = arena_alloc(&reader->arena, sizeof(*key));
+	key->name_length = length;
+	key->entry = NULL;
+	if (ascii) {
+		search_key_init_ascii(&key->name_key, name, length);
+	} else {
+		search_key_init_arena(&key->name_key, name, &reader->arena);
+	}
+
+	int32_t score = history_score(reader, name, length);
+	reader->num_lines++;
+	entry_ref_vec_add(added, key);
+	added->buf[added->count - 1].history_score = score;
+}
+
+/*
+ * Add an entry for a line of input. If mapped is true, the line is in the
+ * mapped file, and ASCII lines (which are already normalised, and need no
+ * case-folded copy for searching) are used where they are rather than being
+ * copied.
+ */
+static void add_line(
+		struct line_reader *reader,
+		struct entry_ref_vec *added,
+		const char *line,
+		size_t length,
+		bool mapped)
+{
+	if (length == 0) {
+		return;
+	}
+	if (utf8_is_ascii_length(line, length)) {
+		char *name = mapped
+			? (char *)line
+			: arena_strndup(&reader->arena, line, length);
+		add_key(reader, added, name, length, true);
+		return;
+	}
+
+	char *name = arena_strndup(&reader->arena, line, length);
+	if (reader->normalize) {
+		if (utf8_validate(name)) {
+			char *normalized = utf8_normalize(name);
+			if (normalized != NULL && strcmp(normalized, name) != 0) {
+				name = arena_strndup(&reader->arena, normalized, strlen(normalized));
+			}
+			free(normalized);
+		} else {
+			log_error("Invalid UTF-8 in input: %s\n", name);
+		}
+	}
+	add_key(reader, added, name, strlen(name), false);
+}
+
+/* Turn every complete line in the buffer into an entry. */
+static void split_lines(struct line_reader *reader, struct entry_ref_vec *added)
+{
+	char *start = reader->buf;
+	char *end = reader->buf + reader->length;
+	char *newline;
+	while ((newline = memchr(start, '\n', end - start)) != NULL) {
+		add_line(reader, added, start, newline - start, false);
+		start = newline + 1;
+	}
+	reader->length = end - start;
+	memmove(reader->buf, start, reader->length);
+}
+
+void line_reader_init(
+		struct line_reader *reader,
+		int fd,
+		bool normalize,
+		const struct history *history)
+{
+	*reader = (struct line_reader) {
+		.fd = fd,
+		.normalize = normalize,
+		.eof = false,
+		.num_lines = 0,
+		.buf = NULL,
+		.length = 0,
+		.size = 0,
+		.map = NULL,
+		.map_size = 0,
+		.map_offset = 0,
+		.scratch = NULL,
+		.scratch_size = 0,
+		.history = NULL
+	};
+	arena_init(&reader->arena, ARENA_BLOCK_SIZE);
+
+	if (history != NULL) {
+		reader->history = g_hash_table_new(g_str_hash, g_str_equal);
+		for (size_t i = 0; i < history->count; i++) {
+			g_hash_table_insert(reader->history, history->buf[i].name, &history->buf[i]);
+		}
+	}
+
+	/*
+	 * A regular file is all there already, so rather than reading it in,
+	 * map it read-only, and have entries for ASCII lines point straight
+	 * into the mapping. Other lines are still copied, to be terminated
+	 * and normalised.
+	 */
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			log_error("Failed to map input: %s.\n", strerror(errno));
+		} else {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			reader->map = map;
+			reader->map_size = st.st_size;
+			log_debug("Mapped %zu bytes of input.\n", reader->map_size);
+			return;
+		}
+	}
+
+	reader->buf = xmalloc(READ_SIZE);
+	reader->size = READ_SIZE;
+
+	/* We'll be polling, so never block waiting for more input. */
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		log_error("Failed to make input non-blocking: %s.\n", strerror(errno));
+	}
+}
+
+void line_reader_destroy(struct line_reader *reader)
+{
+	if (reader->history != NULL) {
+		g_hash_table_unref(reader->history);
+	}
+	free(reader->buf);
+	free(reader->scratch);
+	if (reader->map != NULL) {
+		munmap(reader->map, reader->map_size);
+	}
+	arena_destroy(&reader->arena);
+}
+
+/* Like line_reader_read(), but for a mapped file. */
+static bool read_map(struct line_reader *reader, struct entry_ref_vec *added)
+{
+	char *start = reader->map + reader->map_offset;
+	char *end = reader->map + reader->map_size;
+	char *limit = end - start > READ_LIMIT ? start + READ_LIMIT : end;
+
+	while (start < limit) {
+		char *newline = memchr(start, '\n', end - start);
+		if (newline == NULL) {
+			/* The last line has no newline. */
+			newline = end;
+		}
+		add_line(reader, added, start, newline - start, true);
+		start = newline < end ? newline + 1 : end;
+	}
+
+	reader->map_offset = start - reader->map;
+	if (start == end) {
+		reader->eof = true;
+		log_debug("Read %zu lines of input.\n", reader->num_lines);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Read whatever input is available, and append an entry for each new
+ * complete line to added.
+ *
+ * Returns false once the input has been closed, after which there's no need
+ * to call this again.
+ */
+bool line_reader_read(struct line_reader *reader, struct entry_ref_vec *added)
+{
+	if (reader->eof) {
+		return false;
+	}
+	if (reader->map != NULL) {
+		return read_map(reader, added);
+	}
+
+	size_t total = 0;
+	while (total < READ_LIMIT) {
+		if (reader->size - reader->length < READ_SIZE) {
+			/* A very long line, so make room for more of it. */
+			reader->size *= 2;
+			reader->buf = xrealloc(reader->buf, reader->size);
+		}
+		ssize_t bytes_read = read(
+				reader->fd,
+				&reader->buf[reader->length],
+				READ_SIZE);
+		if (bytes_read < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			log_error("Error reading input: %s.\n", strerror(errno));
+			bytes_read = 0;
+		}
+		if (bytes_read == 0) {
+			/* Don't lose a final line with no newline. */
+			add_line(reader, added, reader->buf, reader->length, false);
+			reader->length = 0;
+			reader->eof = true;
+			log_debug("Read %zu lines of input.\n", reader->num_lines);
+			return false;
+		}
+		reader->length += bytes_read;
+		total += bytes_read;
+		split_lines(reader, added);
+	}
+	return true;
+}
@@ -0,0 +1,56 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+#include "entry.h"
+#include "history.h"
+
+/*
+ * Turns lines arriving on a file descriptor (normally stdin, in dmenu mode)
+ * into entries as they come in, so that they can be shown and filtered
+ * before the other end has finished writing.
+ *
+ * Regular files are mapped into memory rather than read, and entries for
+ * ASCII lines point straight into the mapping.
+ */
+struct line_reader {
+	int fd;
+	bool normalize;
+	bool eof;
+
+	/* Lines' keys and strings live here until the reader is destroyed. */
+	struct arena arena;
+
+	/* How many lines have been read so far. */
+	size_t num_lines;
+
+	/* Any incomplete line left over from the last read. */
+	char *buf;
+	size_t length;
+	size_t size;
+
+	/* The mapped file, if we have one, and how far through it we are. */
+	char *map;
+	size_t map_size;
+	size_t map_offset;
+
+	/* Somewhere to terminate a copy of a line for looking it up. */
+	char *scratch;
+	size_t scratch_size;
+
+	/* Run counts by name, or NULL if we're not using history. */
+	GHashTable *history;
+};
+
+void line_reader_init(
+		struct line_reader *reader,
+		int fd,
+		bool normalize,
+		const struct history *history);
+void line_reader_destroy(struct line_reader *reader);
+bool line_reader_read(struct line_reader *reader, struct entry_ref_vec *added);
+
+#endif /* LINE_READER_H */
@@ -1,8 +1,11 @@
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <libgen.h>
 #include <locale.h>
 #include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,11 +17,16 @@
 #include <wayland-util.h>
 #include <xkbcommon/xkbcommon.h>
 #include "tofi.h"
+#include "app_watcher.h"
 #include "config.h"
+#include "css_cache.h"
+#include "daemon.h"
 #include "drun.h"
 #include "setup.h"
 #include "engine.h"
+#include "filter_worker.h"
 #include "input.h"
+#include "line_reader.h"
 #include "log.h"
 #include "nelem.h"
 #include "lock.h"
@@ -92,41 +100,68 @@ static uint32_t gettime_ms() {
 }
 
 
-/* Read all of stdin into a buffer. */
-static char *read_stdin(bool normalize) {
-	const size_t block_size = BUFSIZ;
-	size_t num_blocks = 1;
-	size_t buf_size = block_size;
+/* Hand any newly arrived lines of input over to the filter thread. */
+static void read_input(struct tofi *tofi, struct line_reader *reader)
+{
+	struct entry_ref_vec added = entry_ref_vec_create();
+	line_reader_read(reader, &added);
+	filter_worker_append(&tofi->window.engine.filter_worker, &added);
+	entry_ref_vec_destroy(&added);
+}
 
-	char *buf = xmalloc(buf_size);
-	for (size_t block = 0; ; block++) {
-		if (block == num_blocks) {
-			num_blocks *= 2;
-			buf = xrealloc(buf, num_blocks * block_size);
-		}
-		size_t bytes_read = fread(
-				&buf[block * block_size],
-				1,
-				block_size,
-				stdin);
-		if (bytes_read != block_size) {
-			if (!feof(stdin) && ferror(stdin)) {
-				log_error("Error reading stdin.\n");
-			}
-			buf[block * block_size + bytes_read] = '\0';
-			break;
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [--drun] [--input-file FILE] [--style FILE] [--daemon]\n", prog);
+}
+
+/* Parse the few options we take on the command line. */
+static void parse_args(struct tofi *tofi, int argc, char *argv[])
+{
+	const struct option long_options[] = {
+		{"drun", no_argument, NULL, 'D'},
+		{"input-file", required_argument, NULL, 'i'},
+		{"style", required_argument, NULL, 's'},
+		{"daemon", no_argument, NULL, 'd'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'D':
+				tofi->window.engine.drun = true;
+				break;
+			case 'i':
+				snprintf(
+						tofi->input_file,
+						N_ELEM(tofi->input_file),
+						"%s",
+						optarg);
+				break;
+			case 's':
+				snprintf(
+						tofi->style_file,
+						N_ELEM(tofi->style_file),
+						"%s",
+						optarg);
+				break;
+			case 'd':
+				tofi->daemon = true;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(EXIT_SUCCESS);
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
 		}
 	}
-	if (normalize) {
-		if (utf8_validate(buf)) {
-			char *tmp = utf8_normalize(buf);
-			free(buf);
-			buf = tmp;
-		} else {
-			log_error("Invalid UTF-8 in stdin.\n");
-		}
+	if (optind < argc) {
+		log_error("Unexpected argument \"%s\".\n", argv[optind]);
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
 	}
-	return buf;
 }
 
 static void zwlr_layer_surface_configure(
@@ -168,6 +203,7 @@ static void zwlr_layer_surface_close(
 {
 	struct tofi *tofi = data;
 	tofi->closed = true;
+	tofi->layer_surface_closed = true;
 	log_debug("Layer surface close.\n");
 }
 
@@ -859,44 +895,64 @@ static const struct wl_surface_listener dummy_surface_listener = {
 };
 
 
-static bool do_submit(struct tofi *tofi)
+/* Write the selected result to out. */
+static bool do_submit(struct tofi *tofi, FILE *out)
 {
 	struct engine *engine = &tofi->window.engine;
+	/*
+	 * The user may have hit Enter before the filter thread caught up with
+	 * their typing, so make sure we're looking at the right results.
+	 */
+	input_wait_results(tofi);
 	uint32_t selection = engine->selection + engine->first_result;
-	char *res = engine->results.buf[selection].entry->name;
 
 	if (tofi->window.engine.results.count == 0) {
 		/* Always require a match in drun mode. */
 		if (tofi->require_match) {
 			return false;
 		} else {
-			printf("%s\n", engine->input_utf8);
+			fprintf(out, "%s\n", engine->input_utf8);
 			return true;
 		}
 	}
 
 	/*
-	 * At this point, the list of apps is history sorted rather
-	 * than alphabetically sorted, so we can't use
-	 * desktop_vec_find_sorted().
+	 * The selection should already have been drawn, but make sure it's
+	 * in its sorted place in case we've not rendered since the last
+	 * keypress.
 	 */
-	struct desktop_entry *app = NULL;
-	for (size_t i = 0; i < engine->apps.count; i++) {
-		if (!strcmp(res, engine->apps.buf[i].name)) {
-			app = &engine->apps.buf[i];
-			break;
+	entry_ref_vec_sort_to(&engine->results, selection + 1);
+	struct entry line;
+	const struct entry *entry = entry_from_key(engine->results.buf[selection].key, &line);
+	const char *res = entry->name;
+
+	if (engine->drun) {
+		/*
+		 * At this point, the list of apps is history sorted rather
+		 * than alphabetically sorted, so we can't use
+		 * desktop_vec_find_sorted().
+		 */
+		struct desktop_entry *app = NULL;
+		for (size_t i = 0; i < engine->apps.count; i++) {
+			if (!strcmp(res, engine->apps.buf[i].name)) {
+				app = &engine->apps.buf[i];
+				break;
+			}
 		}
+		if (app == NULL) {
+			log_error("Couldn't find application file! This shouldn't happen.\n");
+			return false;
+		}
+		char *path = app->path;
+		drun_print(path, tofi->default_terminal, out);
+	} else {
+		fprintf(out, "%.*s\n", (int)entry->name_length, res);
 	}
-	if (app == NULL) {
-		log_error("Couldn't find application file! This shouldn't happen.\n");
-		return false;
-	}
-	char *path = app->path;
-	drun_print(path, tofi->default_terminal);
 	if (tofi->use_history) {
-		history_add(
-				&engine->history,
-				engine->results.buf[selection].entry->name);
+		/* Lines of a mapped input file aren't terminated. */
+		char *name = xstrndup(res, entry->name_length);
+		history_add(&engine->history, name);
+		free(name);
 		if (tofi->history_file[0] == 0) {
 			history_save_default_file(&engine->history, engine->drun);
 		} else {
@@ -993,6 +1049,539 @@ static void read_clipboard(struct tofi *tofi)
 	tofi->window.surface.redraw = true;
 }
 
+/*
+ * Turn a list of apps into the commands to search, sorted by history if we're
+ * using it.
+ */
+[[nodiscard("memory leaked")]]
+static struct entry_ref_vec drun_commands(struct tofi *tofi, struct desktop_vec *apps)
+{
+	struct entry_ref_vec commands = entry_ref_vec_create();
+	if (tofi->use_history) {
+		drun_history_sort(apps, &tofi->window.engine.history);
+	}
+	desktop_vec_build_entries(apps);
+	log_debug("Generating commands.\n");
+	for (size_t i = 0; i < apps->count; i++) {
+		entry_ref_vec_add_desktop(&commands, &apps->buf[i]);
+	}
+	return commands;
+}
+
+/*
+ * Rescan the application dirs that watcher has seen change, and swap the new
+ * list of apps in for the old one. The results start again from the whole
+ * list, so if the window's showing, the query needs filtering again.
+ */
+static void refresh_apps(struct tofi *tofi, struct app_watcher *watcher)
+{
+	struct engine *engine = &tofi->window.engine;
+	log_debug("Application dirs changed, refreshing app list.\n");
+	log_indent();
+	struct desktop_vec apps = drun_refresh(&watcher->changed);
+	struct entry_ref_vec commands = drun_commands(tofi, &apps);
+	app_watcher_clear(watcher);
+	struct string_vec dirs = drun_app_dirs();
+	app_watcher_watch(watcher, &dirs);
+	string_vec_destroy(&dirs);
+	log_unindent();
+
+	/* The filter thread holds on to the old lists, so stop it first. */
+	filter_worker_stop(&engine->filter_worker);
+	entry_ref_vec_destroy(&engine->results);
+	entry_ref_vec_destroy(&engine->commands);
+	desktop_vec_destroy(&engine->apps);
+	engine->apps = apps;
+	engine->commands = commands;
+	engine->results = entry_ref_vec_copy(&engine->commands);
+	engine->selection = 0;
+	engine->first_result = 0;
+	filter_worker_start(
+			&engine->filter_worker,
+			&engine->apps,
+			&engine->commands,
+			engine->drun,
+			tofi->matching_algorithm,
+			tofi->parallel_filter_threshold);
+	log_debug("App list refreshed, %zu apps.\n", engine->apps.count);
+}
+
+/*
+ * Bring the order of the apps up to date with history after a selection, so
+ * that the daemon shows them the way a fresh tofi would. This is only done
+ * while the window's hidden.
+ */
+static void resort_apps(struct tofi *tofi)
+{
+	struct engine *engine = &tofi->window.engine;
+	drun_history_update(&engine->apps, &engine->history);
+	struct entry_ref_vec commands = entry_ref_vec_create();
+	for (size_t i = 0; i < engine->apps.count; i++) {
+		entry_ref_vec_add_desktop(&commands, &engine->apps.buf[i]);
+	}
+	entry_ref_vec_history_sort(&commands);
+
+	/* The filter thread holds on to the old list, so stop it first. */
+	filter_worker_stop(&engine->filter_worker);
+	entry_ref_vec_destroy(&engine->results);
+	entry_ref_vec_destroy(&engine->commands);
+	engine->commands = commands;
+	engine->results = entry_ref_vec_copy(&engine->commands);
+	engine->selection = 0;
+	engine->first_result = 0;
+	filter_worker_start(
+			&engine->filter_worker,
+			&engine->apps,
+			&engine->commands,
+			engine->drun,
+			tofi->matching_algorithm,
+			tofi->parallel_filter_threshold);
+	log_debug("Apps sorted by history again.\n");
+}
+
+/*
+ * Load the stylesheet given with --style, or the user's one if there is one,
+ * on top of the one built into tofi. Either way, style_file is left naming
+ * the file to watch for changes.
+ */
+static struct css load_style(struct tofi *tofi)
+{
+	bool given = tofi->style_file[0] != '\0';
+	if (!given) {
+		char *path = css_default_path();
+		if (path != NULL) {
+			snprintf(tofi->style_file, N_ELEM(tofi->style_file), "%s", path);
+			free(path);
+		}
+	}
+
+	struct css style;
+	if (tofi->style_file[0] != '\0' && css_load_file(&style, tofi->style_file, css)) {
+		return style;
+	}
+	if (given) {
+		log_error("Couldn't load stylesheet %s, using the default.\n", tofi->style_file);
+	}
+	return css_load(css, strlen(css));
+}
+
+/*
+ * Watch the stylesheet's dir rather than the file itself, as editors tend to
+ * replace files rather than writing to them.
+ */
+static void watch_style(struct tofi *tofi, struct app_watcher *watcher)
+{
+	char *copy = xstrdup(tofi->style_file);
+	struct string_vec dirs = string_vec_create();
+	string_vec_add(&dirs, dirname(copy));
+	app_watcher_watch(watcher, &dirs);
+	string_vec_destroy(&dirs);
+	free(copy);
+}
+
+/*
+ * Load the stylesheet again now that something in its dir has changed,
+ * keeping the current one if it's gone or can't be read.
+ */
+static void reload_style(struct tofi *tofi, struct app_watcher *watcher)
+{
+	app_watcher_clear(watcher);
+	watch_style(tofi, watcher);
+
+	struct css style;
+	if (!css_load_file(&style, tofi->style_file, css)) {
+		return;
+	}
+	struct css *current = tofi->window.engine.css;
+	css_destroy(current);
+	*current = style;
+	setup_apply_style(tofi);
+	log_debug("Stylesheet reloaded.\n");
+}
+
+/*
+ * Set up the layer surface's state. This has to be repeated whenever it's
+ * mapped again after being hidden.
+ */
+static void configure_layer_surface(struct tofi *tofi)
+{
+	zwlr_layer_surface_v1_set_keyboard_interactivity(
+			tofi->window.zwlr_layer_surface,
+			ZWLR_LAYER_SURFACE_V1_KEYBOARD_INTERACTIVITY_EXCLUSIVE);
+	zwlr_layer_surface_v1_set_anchor(
+			tofi->window.zwlr_layer_surface,
+			tofi->anchor);
+	zwlr_layer_surface_v1_set_exclusive_zone(
+			tofi->window.zwlr_layer_surface,
+			tofi->window.exclusive_zone);
+	zwlr_layer_surface_v1_set_margin(
+			tofi->window.zwlr_layer_surface,
+			tofi->window.margin_top,
+			tofi->window.margin_right,
+			tofi->window.margin_bottom,
+			tofi->window.margin_left);
+	/*
+	 * No matter whether we're scaling via Cairo or not, we're presenting a
+	 * scaled buffer to Wayland, so scale the window size here if we
+	 * haven't already done so.
+	 */
+	zwlr_layer_surface_v1_set_size(
+			tofi->window.zwlr_layer_surface,
+			tofi->window.width,
+			tofi->window.height);
+}
+
+/*
+ * Show the daemon's window again, as if tofi had just been started. The
+ * layer shell protocol lets us remap a layer surface by committing it without
+ * a buffer and waiting to be configured, just like the first time.
+ */
+static void show_window(struct tofi *tofi)
+{
+	struct engine *engine = &tofi->window.engine;
+	engine->cursor_position = 0;
+	engine->input_utf32_length = 0;
+	engine->input_utf32[0] = U'\0';
+	input_refresh_results(tofi);
+	filter_worker_wait(&engine->filter_worker, &engine->results);
+
+	tofi->closed = false;
+	tofi->submit = false;
+	configure_layer_surface(tofi);
+	wl_surface_commit(tofi->window.surface.wl_surface);
+	wl_display_roundtrip(tofi->wl_display);
+
+	engine_update(engine);
+	surface_draw(&tofi->window.surface);
+	tofi->window.surface.redraw = false;
+}
+
+/* Attaching a null buffer unmaps the layer surface until it's shown again. */
+static void hide_window(struct tofi *tofi)
+{
+	wl_surface_attach(tofi->window.surface.wl_surface, NULL, 0, 0);
+	wl_surface_commit(tofi->window.surface.wl_surface);
+	wl_display_flush(tofi->wl_display);
+	tofi->repeat.active = false;
+}
+
+/* The sooner of two poll() timeouts, where -1 means forever. */
+static int min_timeout(int a, int b)
+{
+	if (a == -1) {
+		return b;
+	}
+	if (b == -1) {
+		return a;
+	}
+	return MIN(a, b);
+}
+
+/*
+ * Wait for a client to connect to the daemon, keeping up with Wayland events
+ * and, if watcher or style_watcher aren't NULL, changes to the application
+ * dirs or the stylesheet meanwhile. Returns the client's connection, or -1 if
+ * we've lost our display or our window.
+ */
+static int wait_for_client(
+		struct tofi *tofi,
+		int listen_fd,
+		struct app_watcher *watcher,
+		struct app_watcher *style_watcher)
+{
+	while (!tofi->layer_surface_closed) {
+		struct pollfd pollfds[4] = {{0}, {0}, {0}, {0}};
+		pollfds[0].fd = wl_display_get_fd(tofi->wl_display);
+		pollfds[0].events = POLLIN | POLLPRI;
+		pollfds[1].fd = listen_fd;
+		pollfds[1].events = POLLIN;
+
+		/*
+		 * Changes come in bursts, so wait for things to settle down
+		 * before refreshing.
+		 */
+		int timeout = -1;
+		pollfds[2].fd = -1;
+		if (watcher != NULL) {
+			pollfds[2].fd = watcher->fd;
+			timeout = app_watcher_timeout(watcher);
+		}
+		pollfds[2].events = POLLIN;
+		pollfds[3].fd = -1;
+		if (style_watcher != NULL) {
+			pollfds[3].fd = style_watcher->fd;
+			timeout = min_timeout(timeout, app_watcher_timeout(style_watcher));
+		}
+		pollfds[3].events = POLLIN;
+
+		while (wl_display_prepare_read(tofi->wl_display) != 0) {
+			wl_display_dispatch_pending(tofi->wl_display);
+		}
+		wl_display_flush(tofi->wl_display);
+
+		if (poll(pollfds, N_ELEM(pollfds), timeout) < 0) {
+			wl_display_cancel_read(tofi->wl_display);
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (pollfds[0].revents & (POLLIN | POLLPRI)) {
+			if (wl_display_read_events(tofi->wl_display) == -1) {
+				return -1;
+			}
+		} else {
+			wl_display_cancel_read(tofi->wl_display);
+		}
+		if (pollfds[0].revents & (POLLERR | POLLHUP)) {
+			return -1;
+		}
+		if (wl_display_dispatch_pending(tofi->wl_display) == -1) {
+			return -1;
+		}
+		if (pollfds[2].revents & POLLIN) {
+			app_watcher_read(watcher);
+		}
+		if (watcher != NULL && app_watcher_ready(watcher)) {
+			refresh_apps(tofi, watcher);
+		}
+		if (pollfds[3].revents & POLLIN) {
+			app_watcher_read(style_watcher);
+		}
+		if (style_watcher != NULL && app_watcher_ready(style_watcher)) {
+			reload_style(tofi, style_watcher);
+		}
+		if (pollfds[1].revents & POLLIN) {
+			int fd = daemon_accept(listen_fd);
+			if (fd != -1) {
+				return fd;
+			}
+		}
+	}
+	return -1;
+}
+
+/*
+ * Run the window until it's closed or a selection is made, which is written
+ * to out. In dmenu mode, input_reader is where more input comes from,
+ * otherwise it's NULL. A daemon passes its listening socket as listen_fd to
+ * turn away any other clients meanwhile, or -1 otherwise, and its watcher
+ * and style_watcher (or NULL) to pick up changes to the application dirs and
+ * the stylesheet between frames.
+ *
+ * Returns true if a selection was made.
+ */
+static bool run_event_loop(
+		struct tofi *tofi,
+		struct line_reader *input_reader,
+		FILE *out,
+		int listen_fd,
+		struct app_watcher *watcher,
+		struct app_watcher *style_watcher)
+{
+	/*
+	 * Main event loop.
+	 * See the wl_display(3) man page for an explanation of the
+	 * order of the various functions called here.
+	 */
+	while (!tofi->closed) {
+		struct pollfd pollfds[7] = {{0}, {0}, {0}, {0}, {0}, {0}, {0}};
+		pollfds[0].fd = wl_display_get_fd(tofi->wl_display);
+
+		/* Make sure we're ready to receive events on the main queue. */
+		while (wl_display_prepare_read(tofi->wl_display) != 0) {
+			wl_display_dispatch_pending(tofi->wl_display);
+		}
+
+		/* Make sure all our requests have been sent to the server. */
+		while (wl_display_flush(tofi->wl_display) != 0) {
+			pollfds[0].events = POLLOUT;
+			poll(&pollfds[0], 1, -1);
+		}
+
+		/*
+		 * Set time to wait for poll() to -1 (unlimited), unless
+		 * there's some key repeating going on.
+		 */
+		int timeout = -1;
+		if (tofi->repeat.active) {
+			int64_t wait = (int64_t)tofi->repeat.next - (int64_t)gettime_ms();
+			if (wait >= 0) {
+				timeout = wait;
+			} else {
+				timeout = 0;
+			}
+		}
+
+		pollfds[0].events = POLLIN | POLLPRI;
+
+		/* The filter thread tells us when it has new results. */
+		pollfds[1].fd = tofi->window.engine.filter_worker.event_fd;
+		pollfds[1].events = POLLIN;
+
+		/*
+		 * If we're trying to paste from the clipboard, which is done
+		 * by reading from a pipe, poll that file descriptor as well.
+		 * Negative descriptors are ignored by poll().
+		 */
+		pollfds[2].fd = tofi->clipboard.fd == 0 ? -1 : tofi->clipboard.fd;
+		pollfds[2].events = POLLIN | POLLPRI;
+
+		/*
+		 * In dmenu mode, watch for more input until there's no more.
+		 * Files are always ready, so they're just read a piece at a
+		 * time between other events.
+		 */
+		pollfds[3].fd = -1;
+		if (input_reader != NULL && !input_reader->eof) {
+			pollfds[3].fd = input_reader->fd;
+		}
+		pollfds[3].events = POLLIN;
+
+		/* A daemon only shows one window at a time. */
+		pollfds[4].fd = listen_fd;
+		pollfds[4].events = POLLIN;
+
+		pollfds[5].fd = -1;
+		if (style_watcher != NULL) {
+			pollfds[5].fd = style_watcher->fd;
+			timeout = min_timeout(timeout, app_watcher_timeout(style_watcher));
+		}
+		pollfds[5].events = POLLIN;
+		pollfds[6].fd = -1;
+		if (watcher != NULL) {
+			pollfds[6].fd = watcher->fd;
+			timeout = min_timeout(timeout, app_watcher_timeout(watcher));
+		}
+		pollfds[6].events = POLLIN;
+
+		int res = poll(pollfds, N_ELEM(pollfds), timeout);
+		if (res == 0) {
+			/*
+			 * No events to process and no error - we presumably
+			 * have a key repeat to handle.
+			 */
+			wl_display_cancel_read(tofi->wl_display);
+			if (tofi->repeat.active) {
+				int64_t wait = (int64_t)tofi->repeat.next - (int64_t)gettime_ms();
+				if (wait <= 0) {
+					input_handle_keypress(tofi, tofi->repeat.keycode);
+					tofi->repeat.next += 1000 / tofi->repeat.rate;
+				}
+			}
+		} else if (res < 0) {
+			/* There was an error polling the display. */
+			wl_display_cancel_read(tofi->wl_display);
+		} else {
+			if (pollfds[0].revents & (POLLIN | POLLPRI)) {
+				/* Events to read, so put them on the queue. */
+				wl_display_read_events(tofi->wl_display);
+			} else {
+				/*
+				 * No events to read - we were woken up to
+				 * handle clipboard data, input or new results.
+				 */
+				wl_display_cancel_read(tofi->wl_display);
+			}
+			if (pollfds[1].revents & POLLIN) {
+				input_receive_results(tofi);
+			}
+			if (pollfds[2].revents & (POLLIN | POLLPRI)) {
+				/* Read clipboard data. */
+				if (tofi->clipboard.fd > 0) {
+					read_clipboard(tofi);
+				}
+			}
+			if (pollfds[2].revents & POLLHUP) {
+				/*
+				 * The other end of the clipboard pipe has
+				 * closed, cleanup.
+				 */
+				clipboard_finish_paste(&tofi->clipboard);
+			}
+			if (pollfds[3].revents & (POLLIN | POLLHUP | POLLERR)) {
+				read_input(tofi, input_reader);
+			}
+			if (pollfds[4].revents & POLLIN) {
+				int fd = daemon_accept(listen_fd);
+				if (fd != -1) {
+					log_debug("Already showing, turning away client.\n");
+					daemon_turn_away(fd);
+				}
+			}
+			if (pollfds[5].revents & POLLIN) {
+				app_watcher_read(style_watcher);
+			}
+			if (pollfds[6].revents & POLLIN) {
+				app_watcher_read(watcher);
+			}
+		}
+
+		/* Handle any events we read. */
+		wl_display_dispatch_pending(tofi->wl_display);
+
+		if (style_watcher != NULL && app_watcher_ready(style_watcher)) {
+			reload_style(tofi, style_watcher);
+			tofi->window.surface.redraw = true;
+		}
+		if (watcher != NULL && app_watcher_ready(watcher)) {
+			refresh_apps(tofi, watcher);
+			input_refresh_results(tofi);
+			input_wait_results(tofi);
+			tofi->window.surface.redraw = true;
+		}
+
+		if (tofi->window.surface.redraw) {
+			engine_update(&tofi->window.engine);
+			surface_draw(&tofi->window.surface);
+			tofi->window.surface.redraw = false;
+		}
+		if (tofi->submit) {
+			tofi->submit = false;
+			if (do_submit(tofi, out)) {
+				return true;
+			}
+		}
+
+	}
+	return false;
+}
+
+/*
+ * Keep everything loaded, and show the window once for each client that
+ * connects, sending the result back to it. If watcher isn't NULL, the list of
+ * apps is kept up to date with it in between, and likewise the stylesheet
+ * with style_watcher.
+ */
+static void run_daemon(
+		struct tofi *tofi,
+		int listen_fd,
+		struct app_watcher *watcher,
+		struct app_watcher *style_watcher)
+{
+	/* Clients may hang up before we answer, which shouldn't kill us. */
+	signal(SIGPIPE, SIG_IGN);
+
+	log_debug("Daemon ready.\n");
+	int fd;
+	while ((fd = wait_for_client(tofi, listen_fd, watcher, style_watcher)) != -1) {
+		FILE *out = fdopen(fd, "w");
+		if (out == NULL) {
+			close(fd);
+			continue;
+		}
+		log_debug("Showing window for client.\n");
+		show_window(tofi);
+		bool selected = run_event_loop(tofi, NULL, out, listen_fd, watcher, style_watcher);
+		fclose(out);
+		hide_window(tofi);
+		if (selected && tofi->use_history) {
+			resort_apps(tofi);
+		}
+	}
+	log_debug("Lost our window, daemon exiting.\n");
+}
+
 int main(int argc, char *argv[])
 {
 	/* Call log_debug to initialise the timers we use for perf checking. */
@@ -1026,10 +1615,53 @@ int main(int argc, char *argv[])
 				"%s",
 				getenv("TERMINAL"));
 	}
+	parse_args(&tofi, argc, argv);
 
 	log_debug("Config done\n");
 
-	if (!tofi.multiple_instance && lock_check()) {
+	/*
+	 * If we were invoked as tofi-drun, or asked with --drun, we're showing
+	 * desktop apps. Otherwise, we're in dmenu mode, reading our input file
+	 * or standard input. Which one is never guessed from what stdin
+	 * happens to be, so the same command always does the same thing.
+	 */
+	const char *prog = strrchr(argv[0], '/');
+	prog = prog == NULL ? argv[0] : prog + 1;
+	if (tofi.daemon) {
+		if (tofi.input_file[0] != 0) {
+			log_error("A daemon can't take an input file.\n");
+			exit(EXIT_FAILURE);
+		}
+		tofi.window.engine.drun = true;
+	} else if (tofi.input_file[0] != 0) {
+		if (tofi.window.engine.drun) {
+			log_error("--drun can't take an input file.\n");
+			exit(EXIT_FAILURE);
+		}
+	} else if (!strcmp(prog, "tofi-drun")) {
+		tofi.window.engine.drun = true;
+	}
+
+	/*
+	 * If a daemon already has everything loaded, let it do the work.
+	 * This comes before anything else to keep startup as quick as
+	 * possible.
+	 */
+	if (!tofi.daemon && tofi.window.engine.drun && daemon_client_run()) {
+		return EXIT_SUCCESS;
+	}
+
+	/*
+	 * A daemon's window is only shown on request, so it shouldn't stop
+	 * anything else from running.
+	 */
+	int listen_fd = -1;
+	if (tofi.daemon) {
+		listen_fd = daemon_listen();
+		if (listen_fd == -1) {
+			exit(EXIT_FAILURE);
+		}
+	} else if (!tofi.multiple_instance && lock_check()) {
 		log_error("Another instance of tofi is already running.\n");
 		exit(EXIT_FAILURE);
 	}
@@ -1256,39 +1888,61 @@ int main(int argc, char *argv[])
 		log_debug("Selected output %s.\n", el->name);
 	}
 
-  struct css parsed_css = css_parse(css);
+  struct css parsed_css = load_style(&tofi);
   tofi.window.engine.css = &parsed_css;
   setup_apply_config(&tofi);
 
 	/*
-	 * If we were invoked as tofi-run, generate the command list.
-	 * If we were invoked as tofi-drun, generate the desktop app list.
-	 * Otherwise, just read standard input.
+	 * In dmenu mode, lines of input are shown as they arrive, so we don't
+	 * wait for any of them here.
 	 */
-	log_debug("Generating desktop app list.\n");
-	log_indent();
-	tofi.window.engine.drun = true;
-	struct desktop_vec apps = drun_generate();
+	int input_fd = STDIN_FILENO;
+	if (tofi.input_file[0] != 0) {
+		input_fd = open(tofi.input_file, O_RDONLY | O_CLOEXEC);
+		if (input_fd == -1) {
+			log_error("Failed to open input file \"%s\": %s.\n",
+					tofi.input_file,
+					strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
 	if (tofi.use_history) {
 		if (tofi.history_file[0] == 0) {
 			tofi.window.engine.history = history_load_default_file(tofi.window.engine.drun);
 		} else {
 			tofi.window.engine.history = history_load(tofi.history_file);
 		}
-		if (tofi.use_history) {
-			drun_history_sort(&apps, &tofi.window.engine.history);
-		}
 	}
-	log_debug("Generating commands.\n");
-	struct entry_ref_vec commands = entry_ref_vec_create();
-	for (size_t i = 0; i < apps.count; i++) {
-		entry_ref_vec_add_desktop(&commands, &apps.buf[i]);
+	struct desktop_vec apps;
+	struct entry_ref_vec commands;
+	struct line_reader input_reader = {0};
+	if (tofi.window.engine.drun) {
+		log_debug("Generating desktop app list.\n");
+		log_indent();
+		apps = drun_generate_cached();
+		commands = drun_commands(&tofi, &apps);
+		log_unindent();
+		log_debug("App list generated.\n");
+	} else {
+		log_debug("Reading options from input.\n");
+		apps = desktop_vec_create();
+		commands = entry_ref_vec_create();
+		line_reader_init(
+				&input_reader,
+				input_fd,
+				!tofi.ascii_input,
+				tofi.use_history ? &tofi.window.engine.history : NULL);
 	}
 	tofi.window.engine.commands = commands;
 	tofi.window.engine.apps = apps;
-	log_unindent();
-	log_debug("App list generated.\n");
 	tofi.window.engine.results = entry_ref_vec_copy(&tofi.window.engine.commands);
+	filter_worker_start(
+			&tofi.window.engine.filter_worker,
+			&tofi.window.engine.apps,
+			&tofi.window.engine.commands,
+			tofi.window.engine.drun,
+			tofi.matching_algorithm,
+			tofi.parallel_filter_threshold);
 
 	/*
 	 * Next, we create the Wayland surface, which takes on the
@@ -1316,34 +1970,11 @@ int main(int argc, char *argv[])
 			wl_output,
 			ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY,
 			"launcher");
-	zwlr_layer_surface_v1_set_keyboard_interactivity(
-			tofi.window.zwlr_layer_surface,
-			ZWLR_LAYER_SURFACE_V1_KEYBOARD_INTERACTIVITY_EXCLUSIVE);
 	zwlr_layer_surface_v1_add_listener(
 			tofi.window.zwlr_layer_surface,
 			&zwlr_layer_surface_listener,
 			&tofi);
-	zwlr_layer_surface_v1_set_anchor(
-			tofi.window.zwlr_layer_surface,
-			tofi.anchor);
-	zwlr_layer_surface_v1_set_exclusive_zone(
-			tofi.window.zwlr_layer_surface,
-			tofi.window.exclusive_zone);
-	zwlr_layer_surface_v1_set_margin(
-			tofi.window.zwlr_layer_surface,
-			tofi.window.margin_top,
-			tofi.window.margin_right,
-			tofi.window.margin_bottom,
-			tofi.window.margin_left);
-	/*
-	 * No matter whether we're scaling via Cairo or not, we're presenting a
-	 * scaled buffer to Wayland, so scale the window size here if we
-	 * haven't already done so.
-	 */
-	zwlr_layer_surface_v1_set_size(
-			tofi.window.zwlr_layer_surface,
-			tofi.window.width,
-			tofi.window.height);
+	configure_layer_surface(&tofi);
 
 	/*
 	 * Set up a viewport for our surface, necessary for fractional scaling.
@@ -1430,8 +2061,15 @@ int main(int argc, char *argv[])
 	log_unindent();
 	log_debug("Renderer initialised.\n");
 
-	/* Perform an initial render. */
-	surface_draw(&tofi.window.surface);
+	/*
+	 * Perform an initial render. A daemon stays hidden until a client
+	 * asks for it, but keeps the buffers in step with the engine.
+	 */
+	if (tofi.daemon) {
+		tofi.window.surface.index = !tofi.window.surface.index;
+	} else {
+		surface_draw(&tofi.window.surface);
+	}
 
 	/*
 	 * engine_init() left the second of the two buffers we use for
@@ -1453,111 +2091,45 @@ int main(int argc, char *argv[])
 	/* We've just rendered, so we don't need to do it again right now. */
 	tofi.window.surface.redraw = false;
 
-	/*
-	 * Main event loop.
-	 * See the wl_display(3) man page for an explanation of the
-	 * order of the various functions called here.
-	 */
-	while (!tofi.closed) {
-		struct pollfd pollfds[2] = {{0}, {0}};
-		pollfds[0].fd = wl_display_get_fd(tofi.wl_display);
-
-		/* Make sure we're ready to receive events on the main queue. */
-		while (wl_display_prepare_read(tofi.wl_display) != 0) {
-			wl_display_dispatch_pending(tofi.wl_display);
-		}
-
-		/* Make sure all our requests have been sent to the server. */
-		while (wl_display_flush(tofi.wl_display) != 0) {
-			pollfds[0].events = POLLOUT;
-			poll(&pollfds[0], 1, -1);
-		}
-
+	if (tofi.daemon) {
 		/*
-		 * Set time to wait for poll() to -1 (unlimited), unless
-		 * there's some key repeating going on.
+		 * A daemon can run for days, so keep an eye out for apps
+		 * being installed or removed.
 		 */
-		int timeout = -1;
-		if (tofi.repeat.active) {
-			int64_t wait = (int64_t)tofi.repeat.next - (int64_t)gettime_ms();
-			if (wait >= 0) {
-				timeout = wait;
-			} else {
-				timeout = 0;
-			}
+		struct app_watcher watcher;
+		bool watching = app_watcher_init(&watcher);
+		if (watching) {
+			struct string_vec dirs = drun_app_dirs();
+			app_watcher_watch(&watcher, &dirs);
+			string_vec_destroy(&dirs);
 		}
-
-		pollfds[0].events = POLLIN | POLLPRI;
-		int res;
-		if (tofi.clipboard.fd == 0) {
-			res = poll(&pollfds[0], 1, timeout);
-		} else {
-			/*
-			 * We're trying to paste from the clipboard, which is
-			 * done by reading from a pipe, so poll that file
-			 * descriptor as well.
-			 */
-			pollfds[1].fd = tofi.clipboard.fd;
-			pollfds[1].events = POLLIN | POLLPRI;
-			res = poll(pollfds, 2, timeout);
-		}
-		if (res == 0) {
-			/*
-			 * No events to process and no error - we presumably
-			 * have a key repeat to handle.
-			 */
-			wl_display_cancel_read(tofi.wl_display);
-			if (tofi.repeat.active) {
-				int64_t wait = (int64_t)tofi.repeat.next - (int64_t)gettime_ms();
-				if (wait <= 0) {
-					input_handle_keypress(&tofi, tofi.repeat.keycode);
-					tofi.repeat.next += 1000 / tofi.repeat.rate;
-				}
-			}
-		} else if (res < 0) {
-			/* There was an error polling the display. */
-			wl_display_cancel_read(tofi.wl_display);
-		} else {
-			if (pollfds[0].revents & (POLLIN | POLLPRI)) {
-				/* Events to read, so put them on the queue. */
-				wl_display_read_events(tofi.wl_display);
-			} else {
-				/*
-				 * No events to read - we were woken up to
-				 * handle clipboard data.
-				 */
-				wl_display_cancel_read(tofi.wl_display);
-			}
-			if (pollfds[1].revents & (POLLIN | POLLPRI)) {
-				/* Read clipboard data. */
-				if (tofi.clipboard.fd > 0) {
-					read_clipboard(&tofi);
-				}
-			}
-			if (pollfds[1].revents & POLLHUP) {
-				/*
-				 * The other end of the clipboard pipe has
-				 * closed, cleanup.
-				 */
-				clipboard_finish_paste(&tofi.clipboard);
-			}
+		/* Likewise, let the stylesheet be tweaked without a restart. */
+		struct app_watcher style_watcher;
+		bool watching_style = tofi.style_file[0] != '\0'
+			&& app_watcher_init(&style_watcher);
+		if (watching_style) {
+			watch_style(&tofi, &style_watcher);
 		}
-
-		/* Handle any events we read. */
-		wl_display_dispatch_pending(tofi.wl_display);
-
-		if (tofi.window.surface.redraw) {
-			engine_update(&tofi.window.engine);
-			surface_draw(&tofi.window.surface);
-			tofi.window.surface.redraw = false;
+		run_daemon(
+				&tofi,
+				listen_fd,
+				watching ? &watcher : NULL,
+				watching_style ? &style_watcher : NULL);
+		if (watching) {
+			app_watcher_destroy(&watcher);
 		}
-		if (tofi.submit) {
-			tofi.submit = false;
-			if (do_submit(&tofi)) {
-				break;
-			}
+		if (watching_style) {
+			app_watcher_destroy(&style_watcher);
 		}
-
+		daemon_close(listen_fd);
+	} else {
+		run_event_loop(
+				&tofi,
+				tofi.window.engine.drun ? NULL : &input_reader,
+				stdout,
+				-1,
+				NULL,
+				NULL);
 	}
 
 	log_debug("Window closed, performing cleanup.\n");
@@ -1610,6 +2182,13 @@ int main(int argc, char *argv[])
 	xkb_keymap_unref(tofi.xkb_keymap);
 	xkb_context_unref(tofi.xkb_context);
 	wl_registry_destroy(tofi.wl_registry);
+	filter_worker_stop(&tofi.window.engine.filter_worker);
+	if (!tofi.window.engine.drun) {
+		line_reader_destroy(&input_reader);
+		if (input_reader.fd != STDIN_FILENO) {
+			close(input_reader.fd);
+		}
+	}
 	desktop_vec_destroy(&tofi.window.engine.apps);
 	if (tofi.window.engine.command_buffer != NULL) {
 		free(tofi.window.engine.command_buffer);
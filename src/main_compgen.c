@@ -5,12 +5,12 @@
 
 int main()
 {
-	char *buf = compgen_cached();
-	struct string_ref_vec commands = string_ref_vec_from_buffer(buf);
+	struct compgen_cache cache;
+	struct string_ref_vec commands = compgen_cached(&cache);
 	for (size_t i = 0; i < commands.count; i++) {
 		fputs(commands.buf[i].string, stdout);
 		fputc('\n', stdout);
 	}
 	string_ref_vec_destroy(&commands);
-	free(buf);
+	compgen_cache_destroy(&cache);
 }
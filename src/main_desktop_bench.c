@@ -0,0 +1,167 @@
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "desktop_file.h"
+#include "desktop_vec.h"
+#include "xmalloc.h"
+
+/*
+ * Compares desktop_file_parse() with the GKeyFile code it replaced, on the
+ * .desktop files given on the command line. Each file is read into memory
+ * first, so only parsing is timed, and both parsers' results are checked to
+ * be the same.
+ */
+
+#define ITERATIONS 200
+
+struct file {
+	const char *path;
+	char *buf;
+	size_t length;
+};
+
+static void free_info(struct desktop_info *info)
+{
+	free(info->name);
+	free(info->icon);
+	free(info->keywords);
+	free(info->only_show_in);
+	free(info->not_show_in);
+}
+
+/* How desktop_info_load() used to work. */
+static bool keyfile_parse(struct desktop_info *info, const char *buf, size_t length)
+{
+	*info = (struct desktop_info) { 0 };
+	GKeyFile *file = g_key_file_new();
+	if (!g_key_file_load_from_data(file, buf, length, G_KEY_FILE_NONE, NULL)) {
+		g_key_file_unref(file);
+		return false;
+	}
+
+	const char *group = "Desktop Entry";
+	info->hidden = g_key_file_get_boolean(file, group, "Hidden", NULL)
+		|| g_key_file_get_boolean(file, group, "NoDisplay", NULL);
+	if (info->hidden) {
+		g_key_file_unref(file);
+		return true;
+	}
+	info->name = g_key_file_get_locale_string(file, group, "Name", NULL, NULL);
+	if (info->name == NULL) {
+		g_key_file_unref(file);
+		return false;
+	}
+	info->icon = g_key_file_get_locale_string(file, group, "Icon", NULL, NULL);
+	info->keywords = g_key_file_get_locale_string(file, group, "Keywords", NULL, NULL);
+	info->only_show_in = g_key_file_get_string(file, group, "OnlyShowIn", NULL);
+	info->not_show_in = g_key_file_get_string(file, group, "NotShowIn", NULL);
+	g_key_file_unref(file);
+	return true;
+}
+
+static bool str_same(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL) {
+		return a == b;
+	}
+	return strcmp(a, b) == 0;
+}
+
+static bool same_info(const struct desktop_info *a, const struct desktop_info *b)
+{
+	return a->hidden == b->hidden
+		&& str_same(a->name, b->name)
+		&& str_same(a->icon, b->icon)
+		&& str_same(a->keywords, b->keywords)
+		&& str_same(a->only_show_in, b->only_show_in)
+		&& str_same(a->not_show_in, b->not_show_in);
+}
+
+static bool read_file(struct file *file)
+{
+	gchar *contents;
+	gsize length;
+	if (!g_file_get_contents(file->path, &contents, &length, NULL)) {
+		return false;
+	}
+	file->buf = xmalloc(length);
+	memcpy(file->buf, contents, length);
+	file->length = length;
+	g_free(contents);
+	return true;
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s FILE.desktop...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char *const *languages = (const char *const *)g_get_language_names();
+	size_t count = 0;
+	struct file *files = xcalloc(argc - 1, sizeof(*files));
+	for (int i = 1; i < argc; i++) {
+		files[count].path = argv[i];
+		if (read_file(&files[count])) {
+			count++;
+		} else {
+			fprintf(stderr, "Couldn't read %s, skipping it.\n", argv[i]);
+		}
+	}
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < count; i++) {
+		struct desktop_info a;
+		struct desktop_info b;
+		bool a_ok = desktop_file_parse(&a, files[i].buf, files[i].length, languages);
+		bool b_ok = keyfile_parse(&b, files[i].buf, files[i].length);
+		if (a_ok != b_ok || (a_ok && !same_info(&a, &b))) {
+			fprintf(stderr, "Parsers disagree on %s.\n", files[i].path);
+			mismatches++;
+		}
+		free_info(&a);
+		free_info(&b);
+	}
+
+	double start = now();
+	for (int n = 0; n < ITERATIONS; n++) {
+		for (size_t i = 0; i < count; i++) {
+			struct desktop_info info;
+			desktop_file_parse(&info, files[i].buf, files[i].length, languages);
+			free_info(&info);
+		}
+	}
+	double native = now() - start;
+
+	start = now();
+	for (int n = 0; n < ITERATIONS; n++) {
+		for (size_t i = 0; i < count; i++) {
+			struct desktop_info info;
+			keyfile_parse(&info, files[i].buf, files[i].length);
+			free_info(&info);
+		}
+	}
+	double keyfile = now() - start;
+
+	double runs = (double)ITERATIONS * (count > 0 ? count : 1);
+	printf("%zu files, %zu mismatches\n", count, mismatches);
+	printf("desktop_file_parse: %.2f us/file\n", native / runs * 1e6);
+	printf("GKeyFile:           %.2f us/file\n", keyfile / runs * 1e6);
+
+	for (size_t i = 0; i < count; i++) {
+		free(files[i].buf);
+	}
+	free(files);
+	return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
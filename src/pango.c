@@ -367,10 +367,12 @@ void pango_update(struct engine *engine)
 
 		const char *name, *comment;
     const struct icon *icon;
+		struct entry line;
 		if (i < engine->results.count) {
-			icon = engine->results.buf[index].entry->icon;
-			name = engine->results.buf[index].entry->name;
-			comment = engine->results.buf[index].entry->comment;
+			const struct entry *result = entry_from_key(engine->results.buf[index].key, &line);
+			icon = result->icon;
+			name = result->name;
+			comment = result->comment;
 		} else {
 			name = "";
 			comment = "";
@@ -1,6 +1,8 @@
 #include <cairo/cairo.h>
 #include <pango/pangocairo.h>
 #include <pango/pango.h>
+#include <stdlib.h>
+#include <string.h>
 #include "pango_css.h"
 #include "css.h"
 #include "engine.h"
@@ -42,27 +44,95 @@ static void rounded_rectangle(cairo_t *cr, uint32_t width, uint32_t height, uint
   cairo_close_path(cr);
 }
 
-static void render_text(
+static void show_layout(
     cairo_t *cr,
-    struct engine *engine,
-    const char *text,
+    PangoLayout *layout,
     const struct css_rule *css,
     PangoRectangle *ink_rect,
     PangoRectangle *logical_rect)
 {
-  log_debug("rendering text %s.\n", text);
-  PangoLayout *layout = engine->pango.layout;
-  struct color color = css_get_attr_color(css, "color");
+  struct color color = css_get_attr_color(css, CSS_COLOR);
   cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
 
-  pango_layout_set_text(layout, text, -1);
+  /* This only lays the text out again if the font options have changed. */
   pango_cairo_update_layout(cr, layout);
   pango_cairo_show_layout(cr, layout);
 
   pango_layout_get_pixel_extents(layout, ink_rect, logical_rect);
+}
+
+static void render_text(
+    cairo_t *cr,
+    struct engine *engine,
+    const char *text,
+    const struct css_rule *css,
+    PangoRectangle *ink_rect,
+    PangoRectangle *logical_rect)
+{
+  log_debug("rendering text %s.\n", text);
+  PangoLayout *layout = engine->pango.layout;
+  pango_layout_set_text(layout, text, -1);
+  show_layout(cr, layout, css, ink_rect, logical_rect);
   log_debug("text rendered.\n", text);
 }
 
+/*
+ * The layout for key's row, showing text. Rows that stay on screen from one
+ * frame to the next keep their layout in the cache, so they're just drawn
+ * again rather than shaped again. The text is checked as well as the key, as
+ * keys can be freed and their memory reused when the list of apps is
+ * refreshed.
+ */
+static PangoLayout *row_layout(
+    struct engine *engine,
+    const struct entry_key *key,
+    const char *text,
+    size_t length)
+{
+  struct pango *pango = &engine->pango;
+  struct pango_row *lru = &pango->rows[0];
+  for (size_t i = 0; i < N_ELEM(pango->rows); i++) {
+    struct pango_row *row = &pango->rows[i];
+    if (row->key == key
+        && row->text != NULL
+        && row->text_length == length
+        && memcmp(row->text, text, length) == 0) {
+      row->last_used = pango->frame;
+      return row->layout;
+    }
+    if (row->last_used < lru->last_used) {
+      lru = row;
+    }
+  }
+
+  if (lru->layout == NULL) {
+    lru->layout = pango_layout_new(pango->context);
+    /* Pick up the font features set on the main layout. */
+    pango_layout_set_attributes(lru->layout, pango_layout_get_attributes(pango->layout));
+  }
+  free(lru->text);
+  lru->key = key;
+  lru->text = xstrndup(text, length);
+  lru->text_length = length;
+  lru->last_used = pango->frame;
+  pango_layout_set_text(lru->layout, text, length);
+  return lru->layout;
+}
+
+/*
+ * The class bits for entry in css. They're looked up by name the first time
+ * the entry is drawn with each compiled stylesheet, and kept in the entry
+ * after that.
+ */
+static uint64_t entry_classes(const struct css *css, struct entry *entry)
+{
+  if (entry->css_generation != css->generation) {
+    entry->css_classes = entry->css_class == NULL ? 0 : css_class_bit(css, entry->css_class);
+    entry->css_generation = css->generation;
+  }
+  return entry->css_classes;
+}
+
 static void render_input(
     cairo_t *cr,
     PangoLayout *layout,
@@ -73,8 +143,8 @@ static void render_input(
     PangoRectangle *ink_rect,
     PangoRectangle *logical_rect)
 {
-  struct directional padding = css_get_attr_dir(css, "padding");
-  struct color color = css_get_attr_color(css, "color");
+  struct directional padding = css_get_attr_padding(css);
+  struct color color = css_get_attr_color(css, CSS_COLOR);
   cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
 
   pango_layout_set_text(layout, text, -1);
@@ -105,7 +175,7 @@ static void render_input(
 
   /*
   {
-  struct color bg_color = css_get_attr_color(css, "background-color");
+  struct color bg_color = css_get_attr_color(css, CSS_BACKGROUND_COLOR);
     if (bg_color.a != 0) {
       cairo_save(cr);
       cairo_set_source_rgba(cr, bg_color.r, bg_color.g, bg_color.b, bg_color.a);
@@ -155,10 +225,10 @@ static void render_input(
   }
 
   cairo_save(cr);
-  struct color cursor = css_get_attr_color(css, "caret-color");
+  struct color cursor = css_get_attr_color(css, CSS_CARET_COLOR);
   cairo_set_source_rgba(cr, cursor.r, cursor.g, cursor.b, cursor.a);
   cairo_translate(cr, cursor_x, 0);
-  switch (css_get_attr_shape(css, "caret-shape")) {
+  switch (css_get_attr_shape(css, CSS_CARET_SHAPE)) {
     case BAR:
       rounded_rectangle(cr, 2, logical_rect->height, 0);
       cairo_fill(cr);
@@ -246,6 +316,13 @@ void pango_init(struct engine *engine, uint32_t *width, uint32_t *height)
 
 void pango_destroy(struct engine *engine)
 {
+  for (size_t i = 0; i < N_ELEM(engine->pango.rows); i++) {
+    struct pango_row *row = &engine->pango.rows[i];
+    if (row->layout != NULL) {
+      g_object_unref(row->layout);
+    }
+    free(row->text);
+  }
   g_object_unref(engine->pango.layout);
   g_object_unref(engine->pango.context);
 }
@@ -278,28 +355,29 @@ void pango_update(struct engine *engine)
   log_debug("Doing pango update\n");
   cairo_t *cr = engine->cairo[engine->index].cr;
   PangoLayout *layout = engine->pango.layout;
+  engine->pango.frame++;
 
   cairo_save(cr);
 
   /* Render the prompt */
   PangoRectangle ink_rect;
   PangoRectangle logical_rect;
-  struct css_rule prompt_css = css_select(engine->css, "input::before");
-  render_text(cr, engine, engine->prompt_text, &prompt_css, &ink_rect, &logical_rect);
+  const struct css_rule *prompt_css = css_style(engine->css, CSS_STYLE_INPUT_BEFORE);
+  render_text(cr, engine, engine->prompt_text, prompt_css, &ink_rect, &logical_rect);
 
   cairo_translate(cr, logical_rect.width + logical_rect.x, 0);
-  int prompt_padding_right = css_get_attr_int(&prompt_css, "padding-right");
+  int prompt_padding_right = css_get_attr_int(prompt_css, CSS_PADDING_RIGHT);
 
   /* Render the engine text */
-  struct css_rule input_css = css_select(engine->css, "input");
-  struct css_rule input_placeholder_css = css_select(engine->css, "input::placeholder");
+  const struct css_rule *input_css = css_style(engine->css, CSS_STYLE_INPUT);
+  const struct css_rule *input_placeholder_css = css_style(engine->css, CSS_STYLE_INPUT_PLACEHOLDER);
   if (engine->input_utf8_length == 0) {
     render_input(
         cr,
         layout,
         engine->placeholder_text,
         utf8_strlen(engine->placeholder_text),
-        &input_placeholder_css,
+        input_placeholder_css,
         0,
         &ink_rect,
         &logical_rect);
@@ -309,7 +387,7 @@ void pango_update(struct engine *engine)
         layout,
         engine->input_utf8,
         engine->input_utf32_length,
-        &input_css,
+        input_css,
         engine->cursor_position,
         &ink_rect,
         &logical_rect);
@@ -342,26 +420,41 @@ void pango_update(struct engine *engine)
     if (index >= engine->results.count) {
       break;
     }
+    /* Results are only put in order as far as they're shown. */
+    entry_ref_vec_sort_to(&engine->results, index + 1);
 
     const char *name, *comment;
     const struct icon *icon;
+    struct entry_key *key = NULL;
+    struct entry line;
+    struct entry *result = NULL;
+    uint64_t classes = 0;
     if (i < engine->results.count) {
-      struct entry *result = engine->results.buf[index].entry;
+      key = engine->results.buf[index].key;
+      result = entry_from_key(key, &line);
       icon = result->icon;
       name = result->name;
       comment = result->comment;
+      classes = entry_classes(engine->css, result);
     } else {
       name = "";
       comment = "";
     }
+    if (i == engine->selection) {
+      classes |= engine->css->selected_class;
+    }
 
-    struct css_rule icon_css = css_select(engine->css, "entry::before");
-
-    struct css_rule result_css = css_select(engine->css, "entry");
-    struct color color = css_get_attr_color(&result_css, "color");
+    /* Icons aren't drawn yet, so there's no need for the entry::before style. */
+    const struct css_rule *result_css = css_style_with_classes(engine->css, CSS_STYLE_ENTRY, classes);
+    struct color color = css_get_attr_color(result_css, CSS_COLOR);
     cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
 
-    render_text(cr, engine, name, &result_css, &ink_rect, &logical_rect);
+    if (result != NULL) {
+      PangoLayout *row = row_layout(engine, key, name, result->name_length);
+      show_layout(cr, row, result_css, &ink_rect, &logical_rect);
+    } else {
+      render_text(cr, engine, name, result_css, &ink_rect, &logical_rect);
+    }
   }
 
   engine->num_results_drawn = i;
@@ -5,10 +5,30 @@
 #include "css.h"
 
 struct engine;
+struct entry_key;
+
+/* Enough for a screenful of results, and a bit of scrolling back. */
+#define PANGO_ROW_CACHE_SIZE 64
+
+/*
+ * A result row's text, already laid out. Every row uses the same font, so a
+ * layout stays good for as long as its key's text is the same.
+ */
+struct pango_row {
+	const struct entry_key *key;
+	char *text;
+	size_t text_length;
+	PangoLayout *layout;
+	uint64_t last_used;
+};
 
 struct pango {
 	PangoContext *context;
 	PangoLayout *layout;
+
+	/* Least recently used rows are replaced first. */
+	struct pango_row rows[PANGO_ROW_CACHE_SIZE];
+	uint64_t frame;
 };
 
 void pango_init(struct engine *engine, uint32_t *width, uint32_t *height);
@@ -0,0 +1,224 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "search_key.h"
+#include "unicode.h"
+#include "xmalloc.h"
+
+/*
+ * Map a (case-folded) character to one of the 64 bits of a signature.
+ * ASCII letters and digits get a bit each, everything else shares the rest.
+ */
+static inline uint64_t signature_bit(uint32_t c)
+{
+	if (c >= U'a' && c <= U'z') {
+		return UINT64_C(1) << (c - U'a');
+	}
+	if (c >= U'0' && c <= U'9') {
+		return UINT64_C(1) << (26 + c - U'0');
+	}
+	return UINT64_C(1) << (36 + c % 28);
+}
+
+static uint64_t utf8_signature(const char *str)
+{
+	uint64_t sig = 0;
+	for (const char *c = str; *c != '\0'; c = utf8_next_char(c)) {
+		sig |= signature_bit(utf8_to_utf32(c));
+	}
+	return sig;
+}
+
+static char *casefold(const char *str)
+{
+	char *folded = utf8_casefold(str);
+	if (folded == NULL) {
+		folded = xstrdup(str);
+	}
+	return folded;
+}
+
+/* Allocate from arena if there is one, or the heap otherwise. */
+static void *key_alloc(struct arena *arena, size_t size)
+{
+	if (arena != NULL) {
+		return arena_alloc(arena, size);
+	}
+	return xmalloc(size);
+}
+
+/*
+ * An ASCII key is just its string: matching works on the bytes directly, and
+ * takes characters and their flags from them as it goes, so nothing is
+ * allocated.
+ */
+static void ascii_key_init(struct search_key *key, const char *str, size_t length)
+{
+	uint64_t sig = 0;
+	for (size_t i = 0; i < length; i++) {
+		sig |= signature_bit(search_ascii_tolower(str[i]));
+	}
+	*key = (struct search_key) {
+		.str = str,
+		.ascii = true,
+		.folded = NULL,
+		.chars = NULL,
+		.flags = NULL,
+		.length = length,
+		.signature = sig
+	};
+}
+
+/*
+ * Fuzzy matching compares characters with utf32_tolower(), and simple
+ * matching compares case-folded strings, so the key's signature includes the
+ * characters of both forms. That way, if any character of a query's signature
+ * is missing from the key's, the string can't match with either algorithm.
+ *
+ * Case-folding ASCII is the same as lowercasing it, so ASCII strings get
+ * neither a folded copy nor an array of characters, see ascii_key_init().
+ */
+static void key_init(struct search_key *key, const char *str, struct arena *arena)
+{
+	if (utf8_is_ascii(str)) {
+		ascii_key_init(key, str, strlen(str));
+		return;
+	}
+
+	size_t length = utf8_strlen(str);
+
+	/* Keep the characters and their flags in a single allocation. */
+	uint32_t *chars = key_alloc(arena, length * (sizeof(*chars) + 1) + 1);
+	uint8_t *flags = (uint8_t *)(chars + length);
+
+	uint64_t sig = 0;
+	size_t i = 0;
+	for (const char *c = str; *c != '\0'; c = utf8_next_char(c), i++) {
+		uint32_t ch = utf8_to_utf32(c);
+		flags[i] = 0;
+		if (utf32_isupper(ch)) {
+			flags[i] |= SEARCH_KEY_UPPER;
+		}
+		if (utf32_islower(ch)) {
+			flags[i] |= SEARCH_KEY_LOWER;
+		}
+		if (utf32_isalnum(ch)) {
+			flags[i] |= SEARCH_KEY_ALNUM;
+		}
+		chars[i] = utf32_tolower(ch);
+		sig |= signature_bit(chars[i]);
+	}
+
+	char *folded = casefold(str);
+	sig |= utf8_signature(folded);
+	if (arena != NULL) {
+		char *copy = arena_strndup(arena, folded, strlen(folded));
+		free(folded);
+		folded = copy;
+	}
+
+	*key = (struct search_key) {
+		.str = str,
+		.ascii = false,
+		.folded = folded,
+		.chars = chars,
+		.flags = flags,
+		.length = length,
+		.signature = sig
+	};
+}
+
+void search_key_init(struct search_key *key, const char *str)
+{
+	key_init(key, str, NULL);
+}
+
+/*
+ * Like search_key_init(), but take all memory from arena, so the key doesn't
+ * need destroying, and keys built one after another sit together in memory.
+ */
+void search_key_init_arena(struct search_key *key, const char *str, struct arena *arena)
+{
+	key_init(key, str, arena);
+}
+
+/*
+ * Build a key for the first length bytes of str, which must be ASCII, and
+ * needn't be NUL-terminated.
+ */
+void search_key_init_ascii(struct search_key *key, const char *str, size_t length)
+{
+	ascii_key_init(key, str, length);
+}
+
+void search_key_destroy(struct search_key *key)
+{
+	free(key->folded);
+	free(key->chars);
+}
+
+static void search_word_init(struct search_word *word, const char *str)
+{
+	word->folded = casefold(str);
+	word->folded_length = strlen(word->folded);
+	word->ascii = utf8_is_ascii(word->folded);
+	word->length = utf8_strlen(str);
+	word->chars = xmalloc(word->length * sizeof(*word->chars) + 1);
+	size_t i = 0;
+	for (const char *c = str; *c != '\0'; c = utf8_next_char(c), i++) {
+		word->chars[i] = utf32_tolower(utf8_to_utf32(c));
+	}
+}
+
+/*
+ * Normalise patterns and split it into space-separated words, each of which
+ * must match for a string to match the query.
+ */
+void search_query_init(
+		struct search_query *query,
+		const char *patterns,
+		enum matching_algorithm algorithm)
+{
+	*query = (struct search_query) {
+		.algorithm = algorithm,
+	};
+
+	char *tmp = utf8_normalize(patterns);
+	if (tmp == NULL) {
+		tmp = xstrdup(patterns);
+	}
+
+	size_t size = 0;
+	char *saveptr = NULL;
+	char *word = strtok_r(tmp, " ", &saveptr);
+	while (word != NULL) {
+		if (query->count == size) {
+			size = size == 0 ? 4 : size * 2;
+			query->words = xrealloc(query->words, size * sizeof(query->words[0]));
+		}
+		struct search_word *w = &query->words[query->count];
+		search_word_init(w, word);
+		query->count++;
+
+		if (algorithm == MATCHING_ALGORITHM_NORMAL) {
+			query->signature |= utf8_signature(w->folded);
+		} else {
+			for (size_t i = 0; i < w->length; i++) {
+				query->signature |= signature_bit(w->chars[i]);
+			}
+		}
+		word = strtok_r(NULL, " ", &saveptr);
+	}
+	free(tmp);
+}
+
+void search_query_destroy(struct search_query *query)
+{
+	for (size_t i = 0; i < query->count; i++) {
+		free(query->words[i].folded);
+		free(query->words[i].chars);
+	}
+	free(query->words);
+}
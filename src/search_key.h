@@ -0,0 +1,152 @@
+#ifndef SEARCH_KEY_H
+#define SEARCH_KEY_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+/* Character class flags, used for fuzzy match bonuses. */
+#define SEARCH_KEY_UPPER (1 << 0)
+#define SEARCH_KEY_LOWER (1 << 1)
+#define SEARCH_KEY_ALNUM (1 << 2)
+
+enum matching_algorithm {
+	/* Case-insensitive substring matching of each word. */
+	MATCHING_ALGORITHM_NORMAL,
+	/* Recursive fuzzy matching, see fuzzy_match(). */
+	MATCHING_ALGORITHM_FUZZY,
+	/* Dynamic-programming fuzzy matching, see fuzzy_match_dp(). */
+	MATCHING_ALGORITHM_FUZZY_DP
+};
+
+/*
+ * Everything the matchers need to know about a string, worked out once when
+ * the string is loaded rather than on every keypress.
+ */
+struct search_key {
+	/*
+	 * The original string, which must outlive the key. If it's pure
+	 * ASCII, this is searched directly, folded, chars and flags are all
+	 * NULL, and it needn't be NUL-terminated.
+	 */
+	const char *str;
+	bool ascii;
+	/* Case-folded copy of the string, for simple matching. */
+	char *folded;
+	/*
+	 * Lowercased characters, for fuzzy matching. Use search_key_char(),
+	 * which works for ASCII keys too.
+	 */
+	uint32_t *chars;
+	/* SEARCH_KEY_* flags for each character, see search_key_flags(). */
+	uint8_t *flags;
+	/* The number of characters in the string. */
+	size_t length;
+	/* Bitmap of the characters that occur in the string. */
+	uint64_t signature;
+};
+
+struct search_word {
+	/* Case-folded UTF-8, for simple matching. */
+	char *folded;
+	size_t folded_length;
+	/* Whether folded is pure ASCII, so the vectorised search can be used. */
+	bool ascii;
+	/* Lowercased characters, for fuzzy matching. */
+	uint32_t *chars;
+	size_t length;
+};
+
+/* A query, normalised and split into words once per keypress. */
+struct search_query {
+	enum matching_algorithm algorithm;
+	size_t count;
+	struct search_word *words;
+	/* Bitmap of the characters a string must contain to match. */
+	uint64_t signature;
+	/*
+	 * If not NULL, matching loops give up early once this becomes true,
+	 * leaving their results incomplete.
+	 */
+	const atomic_bool *cancel;
+};
+
+void search_key_init(struct search_key *key, const char *str);
+void search_key_init_arena(struct search_key *key, const char *str, struct arena *arena);
+void search_key_init_ascii(struct search_key *key, const char *str, size_t length);
+void search_key_destroy(struct search_key *key);
+
+void search_query_init(
+		struct search_query *query,
+		const char *patterns,
+		enum matching_algorithm algorithm);
+void search_query_destroy(struct search_query *query);
+
+/*
+ * How many entries matching loops go between checks of query->cancel.
+ */
+#define SEARCH_QUERY_CANCEL_INTERVAL 256
+
+static inline bool search_query_cancelled(const struct search_query *query)
+{
+	return query->cancel != NULL
+		&& atomic_load_explicit(query->cancel, memory_order_relaxed);
+}
+
+/*
+ * Returns true if a string with the given signature could possibly match
+ * query, judging only by which characters they contain.
+ */
+static inline bool search_signature_covers(
+		uint64_t signature,
+		const struct search_query *query)
+{
+	return (query->signature & ~signature) == 0;
+}
+
+static inline bool search_key_covers(
+		const struct search_key *key,
+		const struct search_query *query)
+{
+	return search_signature_covers(key->signature, query);
+}
+
+static inline char search_ascii_tolower(char c)
+{
+	if (c >= 'A' && c <= 'Z') {
+		return c | 0x20;
+	}
+	return c;
+}
+
+/* The lowercased character at index i of key. */
+static inline uint32_t search_key_char(const struct search_key *key, size_t i)
+{
+	if (key->ascii) {
+		return (unsigned char)search_ascii_tolower(key->str[i]);
+	}
+	return key->chars[i];
+}
+
+/* The SEARCH_KEY_* flags for the character at index i of key. */
+static inline uint8_t search_key_flags(const struct search_key *key, size_t i)
+{
+	if (!key->ascii) {
+		return key->flags[i];
+	}
+	char c = key->str[i];
+	if (c >= 'A' && c <= 'Z') {
+		return SEARCH_KEY_UPPER | SEARCH_KEY_ALNUM;
+	}
+	if (c >= 'a' && c <= 'z') {
+		return SEARCH_KEY_LOWER | SEARCH_KEY_ALNUM;
+	}
+	if (c >= '0' && c <= '9') {
+		return SEARCH_KEY_ALNUM;
+	}
+	return 0;
+}
+
+#endif /* SEARCH_KEY_H */
@@ -16,68 +16,89 @@
 #include "unicode.h"
 #include "xmalloc.h"
 
-void apply_window_css(struct tofi *tofi, struct css_rule *rule) {
-  tofi->window.width = css_get_attr_int(rule, "width");
-  tofi->window.height = css_get_attr_int(rule, "height");
-  tofi->window.scale = css_get_attr_int(rule, "scale");
-  char *font_family = css_get_attr_str(rule, "font-family");
-  strncpy(tofi->window.engine.font_name, font_family, strlen(font_family));
-  tofi->window.engine.font_size = css_get_attr_int(rule, "font-size");
-  tofi->window.engine.font_size = css_get_attr_int(rule, "font-size");
-  tofi->anchor = css_get_attr_int(rule, "anchor");
+void apply_window_css(struct tofi *tofi, const struct css_rule *rule) {
+  tofi->window.width = css_get_attr_int(rule, CSS_WIDTH);
+  tofi->window.height = css_get_attr_int(rule, CSS_HEIGHT);
+  tofi->window.scale = css_get_attr_int(rule, CSS_SCALE);
+  if (tofi->window.scale < 1) {
+    log_error("Window scale must be at least 1, using 1.\n");
+    tofi->window.scale = 1;
+  }
+  char *font_family = css_get_attr_str(rule, CSS_FONT_FAMILY);
+  snprintf(
+      tofi->window.engine.font_name,
+      N_ELEM(tofi->window.engine.font_name),
+      "%s",
+      font_family);
+  tofi->window.engine.font_size = css_get_attr_int(rule, CSS_FONT_SIZE);
+  tofi->window.engine.font_size = css_get_attr_int(rule, CSS_FONT_SIZE);
+  tofi->anchor = css_get_attr_int(rule, CSS_ANCHOR);
 }
 
-void apply_body_css(struct tofi *tofi, struct css_rule *rule) {
-  tofi->window.engine.padding_top = css_get_attr_int(rule, "padding-top");
-  tofi->window.engine.padding_bottom = css_get_attr_int(rule, "padding-bottom");
-  tofi->window.engine.padding_left = css_get_attr_int(rule, "padding-left");
-  tofi->window.engine.padding_right = css_get_attr_int(rule, "padding-right");
+void apply_body_css(struct tofi *tofi, const struct css_rule *rule) {
+  tofi->window.engine.padding_top = css_get_attr_int(rule, CSS_PADDING_TOP);
+  tofi->window.engine.padding_bottom = css_get_attr_int(rule, CSS_PADDING_BOTTOM);
+  tofi->window.engine.padding_left = css_get_attr_int(rule, CSS_PADDING_LEFT);
+  tofi->window.engine.padding_right = css_get_attr_int(rule, CSS_PADDING_RIGHT);
 
-  tofi->window.engine.border_width = css_get_attr_int(rule, "border-width");
-  struct color border_color = css_get_attr_color(rule, "border-color");
+  tofi->window.engine.border_width = css_get_attr_int(rule, CSS_BORDER_WIDTH);
+  struct color border_color = css_get_attr_color(rule, CSS_BORDER_COLOR);
   color_copy(&border_color, &tofi->window.engine.border_color);
 
-  tofi->window.engine.outline_width = css_get_attr_int(rule, "outline-width");
-  struct color outline_color = css_get_attr_color(rule, "outline-color");
+  tofi->window.engine.outline_width = css_get_attr_int(rule, CSS_OUTLINE_WIDTH);
+  struct color outline_color = css_get_attr_color(rule, CSS_OUTLINE_COLOR);
   color_copy(&outline_color, &tofi->window.engine.outline_color);
 }
 
-void apply_prompt_css(struct tofi *tofi, struct css_rule *rule) {
-  char *text = css_get_attr_str(rule, "content");
-  strncpy(tofi->window.engine.prompt_text, text, strlen(text));
+void apply_prompt_css(struct tofi *tofi, const struct css_rule *rule) {
+  char *text = css_get_attr_str(rule, CSS_CONTENT);
+  snprintf(
+      tofi->window.engine.prompt_text,
+      N_ELEM(tofi->window.engine.prompt_text),
+      "%s",
+      text);
 
-  struct color color = css_get_attr_color(rule, "color");
+  struct color color = css_get_attr_color(rule, CSS_COLOR);
   color_copy(&color, &tofi->window.engine.prompt_theme.foreground_color);
   tofi->window.engine.prompt_theme.foreground_specified = true;
 }
 
-void apply_placeholder_css(struct tofi *tofi, struct css_rule *rule) {
-  char *text = css_get_attr_str(rule, "content");
-  strncpy(tofi->window.engine.placeholder_text, text, strlen(text));
+void apply_placeholder_css(struct tofi *tofi, const struct css_rule *rule) {
+  char *text = css_get_attr_str(rule, CSS_CONTENT);
+  snprintf(
+      tofi->window.engine.placeholder_text,
+      N_ELEM(tofi->window.engine.placeholder_text),
+      "%s",
+      text);
 
-  struct color color = css_get_attr_color(rule, "color");
+  struct color color = css_get_attr_color(rule, CSS_COLOR);
   color_copy(&color, &tofi->window.engine.placeholder_theme.foreground_color);
   tofi->window.engine.placeholder_theme.foreground_specified = true;
 }
 
-void setup_apply_config(struct tofi *tofi)
+/*
+ * Apply the parts of the stylesheet that are copied out of it and can change
+ * while the window exists. The window and body rules size the window and
+ * draw its border when it's created, so they only take effect on startup.
+ */
+void setup_apply_style(struct tofi *tofi)
 {
   struct css *parsed_css = tofi->window.engine.css;
-  struct css_rule window = css_select(parsed_css, "window");
-  apply_window_css(tofi, &window);
-
-  struct css_rule body = css_select(parsed_css, "body");
-  apply_body_css(tofi, &body);
-
-  struct css_rule prompt = css_select(parsed_css, "input::before");
-  apply_prompt_css(tofi, &prompt);
+  apply_prompt_css(tofi, css_style(parsed_css, CSS_STYLE_INPUT_BEFORE));
+  apply_placeholder_css(tofi, css_style(parsed_css, CSS_STYLE_INPUT_PLACEHOLDER));
+}
 
-  struct css_rule placeholder = css_select(parsed_css, "input::placeholder");
-  apply_placeholder_css(tofi, &placeholder);
+void setup_apply_config(struct tofi *tofi)
+{
+  struct css *parsed_css = tofi->window.engine.css;
+  apply_window_css(tofi, css_style(parsed_css, CSS_STYLE_WINDOW));
+  apply_body_css(tofi, css_style(parsed_css, CSS_STYLE_BODY));
+  setup_apply_style(tofi);
 
   tofi->use_history = use_history;
   tofi->require_match = require_match;
-  tofi->fuzzy_match = fuzzy_match;
+  tofi->matching_algorithm = matching_algorithm;
+  tofi->parallel_filter_threshold = parallel_filter_threshold;
   tofi->multiple_instance = multiple_instance;
   tofi->window.exclusive_zone = exclusive_zone;
 
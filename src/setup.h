@@ -4,5 +4,6 @@
 #include "tofi.h"
 
 void setup_apply_config(struct tofi *tofi);
+void setup_apply_style(struct tofi *tofi);
 
 #endif /* SETUP_H */
@@ -98,14 +98,16 @@ struct string_ref_vec string_ref_vec_copy(const struct string_ref_vec *restrict
 
 void string_vec_add(struct string_vec *restrict vec, const char *restrict str)
 {
-	if (!utf8_validate(str)) {
+	/* Plain ASCII is always valid and already normalised. */
+	bool ascii = utf8_is_ascii(str);
+	if (!ascii && !utf8_validate(str)) {
 		return;
 	}
 	if (vec->count == vec->size) {
 		vec->size *= 2;
 		vec->buf = xrealloc(vec->buf, vec->size * sizeof(vec->buf[0]));
 	}
-	vec->buf[vec->count].string = utf8_normalize(str);
+	vec->buf[vec->count].string = ascii ? NULL : utf8_normalize(str);
 	if (vec->buf[vec->count].string == NULL) {
 		vec->buf[vec->count].string = xstrdup(str);
 	}
@@ -181,25 +183,30 @@ struct scored_string_ref *string_ref_vec_find_sorted(struct string_ref_vec *rest
 struct string_ref_vec string_ref_vec_filter(
 		const struct string_ref_vec *restrict vec,
 		const char *restrict substr,
-		bool fuzzy)
+		enum matching_algorithm matching_algorithm)
 {
 	if (substr[0] == '\0') {
 		return string_ref_vec_copy(vec);
 	}
 	struct string_ref_vec filt = string_ref_vec_create();
+	struct search_query query;
+	search_query_init(&query, substr, matching_algorithm);
 	for (size_t i = 0; i < vec->count; i++) {
-		int32_t search_score;
-		if (fuzzy) {
-			search_score = fuzzy_match_words(substr, vec->buf[i].string);
-		} else {
-			search_score = fuzzy_match_simple_words(substr, vec->buf[i].string);
-		}
+		/*
+		 * Plain strings don't carry a pre-built search key, so we
+		 * have to make one each time.
+		 */
+		struct search_key key;
+		search_key_init(&key, vec->buf[i].string);
+		int32_t search_score = match_words(&query, &key);
+		search_key_destroy(&key);
 		if (search_score != INT32_MIN) {
 			string_ref_vec_add(&filt, vec->buf[i].string);
 			filt.buf[filt.count - 1].search_score = search_score;
 			filt.buf[filt.count - 1].history_score = vec->buf[i].history_score;
 		}
 	}
+	search_query_destroy(&query);
 	/* Sort the results by their search score. */
 	qsort(filt.buf, filt.count, sizeof(filt.buf[0]), cmpscorep);
 	return filt;
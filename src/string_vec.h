@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "search_key.h"
 #include "history.h"
 
 struct scored_string {
@@ -73,7 +74,7 @@ struct scored_string_ref *string_ref_vec_find_sorted(struct string_ref_vec *rest
 struct string_ref_vec string_ref_vec_filter(
 		const struct string_ref_vec *restrict vec,
 		const char *restrict substr,
-		bool fuzzy);
+		enum matching_algorithm matching_algorithm);
 
 [[nodiscard("memory leaked")]]
 struct string_ref_vec string_ref_vec_from_buffer(char *buffer);
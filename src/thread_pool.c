@@ -0,0 +1,127 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <unistd.h>
+#include "log.h"
+#include "thread_pool.h"
+#include "xmalloc.h"
+
+/*
+ * Claim and run tasks from the current job until there are none left.
+ * Must be called with pool->lock held, and returns with it held.
+ */
+static void run_tasks(struct thread_pool *pool)
+{
+	while (pool->next_task < pool->num_tasks) {
+		size_t index = pool->next_task++;
+		thread_pool_task task = pool->task;
+		void *arg = pool->arg;
+
+		mtx_unlock(&pool->lock);
+		task(arg, index);
+		mtx_lock(&pool->lock);
+
+		pool->tasks_done++;
+		if (pool->tasks_done == pool->num_tasks) {
+			cnd_signal(&pool->work_done);
+		}
+	}
+}
+
+static int worker(void *data)
+{
+	struct thread_pool *pool = data;
+	uint64_t generation = 0;
+
+	mtx_lock(&pool->lock);
+	while (true) {
+		while (!pool->quit && pool->generation == generation) {
+			cnd_wait(&pool->work_ready, &pool->lock);
+		}
+		if (pool->quit) {
+			break;
+		}
+		generation = pool->generation;
+		run_tasks(pool);
+	}
+	mtx_unlock(&pool->lock);
+	return 0;
+}
+
+struct thread_pool *thread_pool_create(size_t num_threads)
+{
+	struct thread_pool *pool = xcalloc(1, sizeof(*pool));
+	pool->threads = xcalloc(num_threads, sizeof(*pool->threads));
+	mtx_init(&pool->lock, mtx_plain);
+	cnd_init(&pool->work_ready);
+	cnd_init(&pool->work_done);
+
+	for (size_t i = 0; i < num_threads; i++) {
+		if (thrd_create(&pool->threads[i], worker, pool) != thrd_success) {
+			log_error("Failed to create worker thread.\n");
+			break;
+		}
+		pool->num_threads++;
+	}
+	log_debug("Started %zu worker threads.\n", pool->num_threads);
+	return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+	mtx_lock(&pool->lock);
+	pool->quit = true;
+	cnd_broadcast(&pool->work_ready);
+	mtx_unlock(&pool->lock);
+
+	for (size_t i = 0; i < pool->num_threads; i++) {
+		thrd_join(pool->threads[i], NULL);
+	}
+
+	cnd_destroy(&pool->work_done);
+	cnd_destroy(&pool->work_ready);
+	mtx_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+/*
+ * Call task(arg, i) for each i in [0, num_tasks), spread across the pool,
+ * and wait for them all to finish.
+ */
+void thread_pool_run(
+		struct thread_pool *pool,
+		thread_pool_task task,
+		void *arg,
+		size_t num_tasks)
+{
+	if (num_tasks == 0) {
+		return;
+	}
+
+	mtx_lock(&pool->lock);
+	pool->task = task;
+	pool->arg = arg;
+	pool->num_tasks = num_tasks;
+	pool->next_task = 0;
+	pool->tasks_done = 0;
+	pool->generation++;
+	cnd_broadcast(&pool->work_ready);
+
+	run_tasks(pool);
+	while (pool->tasks_done < pool->num_tasks) {
+		cnd_wait(&pool->work_done, &pool->lock);
+	}
+	mtx_unlock(&pool->lock);
+}
+
+/* The number of worker threads to use alongside the main thread. */
+size_t thread_pool_default_size(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus <= 1) {
+		return 0;
+	}
+	return cpus - 1;
+}
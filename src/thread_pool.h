@@ -0,0 +1,46 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+typedef void (*thread_pool_task)(void *arg, size_t index);
+
+/*
+ * A fixed set of worker threads for splitting up data-parallel work.
+ *
+ * Only one job runs at a time, and the calling thread helps out, so a pool
+ * created with N threads does its work on N + 1 threads.
+ */
+struct thread_pool {
+	size_t num_threads;
+	thrd_t *threads;
+
+	mtx_t lock;
+	cnd_t work_ready;
+	cnd_t work_done;
+
+	/* The current job, protected by lock. */
+	thread_pool_task task;
+	void *arg;
+	size_t num_tasks;
+	size_t next_task;
+	size_t tasks_done;
+	uint64_t generation;
+	bool quit;
+};
+
+[[nodiscard("memory leaked")]]
+struct thread_pool *thread_pool_create(size_t num_threads);
+void thread_pool_destroy(struct thread_pool *pool);
+void thread_pool_run(
+		struct thread_pool *pool,
+		thread_pool_task task,
+		void *arg,
+		size_t num_tasks);
+
+size_t thread_pool_default_size(void);
+
+#endif /* THREAD_POOL_H */
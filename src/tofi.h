@@ -8,6 +8,7 @@
 #include "clipboard.h"
 #include "color.h"
 #include "engine.h"
+#include "search_key.h"
 #include "surface.h"
 #include "wlr-layer-shell-unstable-v1.h"
 #include "fractional-scale-v1.h"
@@ -15,6 +16,8 @@
 #define MAX_OUTPUT_NAME_LEN 256
 #define MAX_TERMINAL_NAME_LEN 256
 #define MAX_HISTORY_FILE_NAME_LEN 256
+#define MAX_INPUT_FILE_NAME_LEN 256
+#define MAX_STYLE_FILE_NAME_LEN 256
 
 struct output_list_element {
 	struct wl_list link;
@@ -54,6 +57,8 @@ struct tofi {
 	/* State */
 	bool submit;
 	bool closed;
+	/* The compositor has taken away our layer surface for good. */
+	bool layer_surface_closed;
 	int32_t output_width;
 	int32_t output_height;
 	struct clipboard clipboard;
@@ -96,12 +101,16 @@ struct tofi {
 	bool use_scale;
 	bool drun_launch;
 	bool drun_print_exec;
-	bool fuzzy_match;
+	enum matching_algorithm matching_algorithm;
+	uint32_t parallel_filter_threshold;
 	bool require_match;
 	bool multiple_instance;
+	bool daemon;
 	char target_output_name[MAX_OUTPUT_NAME_LEN];
 	char default_terminal[MAX_TERMINAL_NAME_LEN];
 	char history_file[MAX_HISTORY_FILE_NAME_LEN];
+	char input_file[MAX_INPUT_FILE_NAME_LEN];
+	char style_file[MAX_STYLE_FILE_NAME_LEN];
 };
 
 #endif /* TOFI_H */
@@ -126,6 +126,11 @@ char *utf8_normalize(const char *s)
 	return g_utf8_normalize(s, -1, G_NORMALIZE_DEFAULT);
 }
 
+char *utf8_casefold(const char *s)
+{
+	return g_utf8_casefold(s, -1);
+}
+
 char *utf8_compose(const char *s)
 {
 	return g_utf8_normalize(s, -1, G_NORMALIZE_DEFAULT_COMPOSE);
@@ -135,3 +140,25 @@ bool utf8_validate(const char *s)
 {
 	return g_utf8_validate(s, -1, NULL);
 }
+
+/* Plain ASCII needs no validating, normalising or case-folding by glib. */
+bool utf8_is_ascii(const char *s)
+{
+	for (const char *c = s; *c != '\0'; c++) {
+		if ((unsigned char)*c >= 0x80) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* As utf8_is_ascii(), for length bytes of s, which needn't be terminated. */
+bool utf8_is_ascii_length(const char *s, size_t length)
+{
+	for (size_t i = 0; i < length; i++) {
+		if ((unsigned char)s[i] >= 0x80) {
+			return false;
+		}
+	}
+	return true;
+}
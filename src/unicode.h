@@ -26,7 +26,10 @@ char *utf8_strcasechr(const char *s, uint32_t c);
 size_t utf8_strlen(const char *s);
 char *utf8_strcasestr(const char * restrict haystack, const char * restrict needle);
 char *utf8_normalize(const char *s);
+char *utf8_casefold(const char *s);
 char *utf8_compose(const char *s);
 bool utf8_validate(const char *s);
+bool utf8_is_ascii(const char *s);
+bool utf8_is_ascii_length(const char *s, size_t length);
 
 #endif /* UNICODE_H */
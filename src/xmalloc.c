@@ -53,3 +53,15 @@ char *xstrdup(const char *s)
 		exit(EXIT_FAILURE);
 	}
 }
+
+char *xstrndup(const char *s, size_t n)
+{
+	char *ptr = strndup(s, n);
+
+	if (ptr != NULL) {
+		return ptr;
+	} else {
+		log_error("Out of memory, exiting.\n");
+		exit(EXIT_FAILURE);
+	}
+}
@@ -18,4 +18,8 @@ void *xrealloc(void *ptr, size_t size);
 [[gnu::malloc]]
 char *xstrdup(const char *s);
 
+[[nodiscard("memory leaked")]]
+[[gnu::malloc]]
+char *xstrndup(const char *s, size_t n);
+
 #endif /* XMALLOC_H */